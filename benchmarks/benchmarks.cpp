@@ -0,0 +1,315 @@
+#include <key-frames-extractor/key-frames-extractor.hpp>
+#include <similar-images-finder/similar-images-scanner.hpp>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QTemporaryDir>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <opencv2/videoio.hpp>
+
+// every input is generated from fixed seeds, so runs on different releases
+// process exactly the same data
+static const unsigned images_seed = 1;
+static const unsigned hashes_seed = 2;
+static const unsigned video_seed = 3;
+static const cv::Size image_size(640, 480);
+static const size_t images_cnt = 64;
+static const size_t hashes_cnt = 1 << 16;
+static const std::array<size_t, 4> pool_sizes = {1000, 10000, 100000,
+                                                 1000000};
+// brute force is quadratic, larger pools take too long
+static const size_t max_brute_force_pool_size = 10000;
+static const size_t max_distance = 5;
+static const cv::Size video_frame_size(320, 240);
+static const size_t video_frames_cnt = 1000;
+static const size_t video_scene_length = 50;
+static const double video_fps = 25;
+
+template <typename F> static double measure_seconds(F &&f) {
+    auto start_time = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_time)
+        .count();
+}
+
+// random rectangles over a gradient, so that every hash sees some structure
+static cv::Mat get_synthetic_image(cv::RNG &rng, const cv::Size &size) {
+    cv::Mat img(size, CV_8UC3);
+    cv::Scalar from(rng.uniform(0, 256), rng.uniform(0, 256),
+                    rng.uniform(0, 256));
+    for (int y = 0; y < img.rows; ++y) {
+        img.row(y).setTo(from * (1. - static_cast<double>(y) / img.rows));
+    }
+    for (int i = 0; i < 16; ++i) {
+        cv::Point a(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::Point b(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::rectangle(img, a, b,
+                      cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256),
+                                 rng.uniform(0, 256)),
+                      cv::FILLED);
+    }
+    return img;
+}
+
+// Base hashes followed by up to three near duplicates each, the pool forms
+// clusters similar to a photo collection with bursts.
+static std::vector<PackedHash> get_synthetic_hashes(size_t cnt) {
+    std::mt19937_64 rng(hashes_seed);
+    std::vector<PackedHash> hashes;
+    hashes.reserve(cnt);
+    while (hashes.size() < cnt) {
+        PackedHash base_hash = rng();
+        hashes.push_back(base_hash);
+        size_t duplicates_cnt = rng() % 4;
+        for (size_t i = 0; i < duplicates_cnt && hashes.size() < cnt; ++i) {
+            PackedHash duplicate_hash = base_hash;
+            for (size_t j = rng() % (max_distance + 1); j > 0; --j) {
+                duplicate_hash ^= PackedHash(1) << (rng() % 64);
+            }
+            hashes.push_back(duplicate_hash);
+        }
+    }
+    return hashes;
+}
+
+static HashesPool get_hashes_pool(const std::vector<PackedHash> &hashes) {
+    HashesPool hashes_pool;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        hashes_pool.push_back(hashes.at(i),
+                              QString("synthetic-%1.jpg").arg(i));
+    }
+    return hashes_pool;
+}
+
+// scenes of slightly moving rectangles separated by hard cuts
+static void write_synthetic_video(const QString &filename) {
+    cv::VideoWriter writer(filename.toStdString(),
+                           cv::VideoWriter::fourcc('M', 'J', 'P', 'G'),
+                           video_fps, video_frame_size);
+    if (!writer.isOpened()) {
+        throw std::runtime_error("Unable to write '" + filename.toStdString() +
+                                 "'.");
+    }
+    cv::RNG rng(video_seed);
+    cv::Mat scene;
+    for (size_t i = 0; i < video_frames_cnt; ++i) {
+        if (i % video_scene_length == 0) {
+            scene = get_synthetic_image(rng, video_frame_size);
+        }
+        cv::Mat frame;
+        cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0,
+                         static_cast<double>(i % video_scene_length), 0, 1, 0);
+        cv::warpAffine(scene, frame, shift, video_frame_size,
+                       cv::INTER_LINEAR, cv::BORDER_REFLECT);
+        writer.write(frame);
+    }
+}
+
+static QJsonObject benchmark_hash_algorithm(
+    const QString &name, cv::Ptr<cv::img_hash::ImgHashBase> algorithm,
+    const std::vector<cv::Mat> &images) {
+    HashHandler hash_handler(algorithm, [](double) { return true; });
+    std::vector<cv::Mat> hashes(images.size());
+    double compute_seconds = measure_seconds([&]() {
+        for (size_t i = 0; i < images.size(); ++i) {
+            hashes.at(i) = hash_handler.compute(images.at(i));
+        }
+    });
+    cv::Mat batch_hashes;
+    double compute_batch_seconds = measure_seconds([&]() {
+        hash_handler.compute_batch(images.data(), images.size(),
+                                   batch_hashes);
+    });
+    size_t comparisons_cnt = 0;
+    double compare_seconds = measure_seconds([&]() {
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            for (size_t j = 0; j < hashes.size(); ++j) {
+                hash_handler.compare(hashes.at(i), hashes.at(j));
+                ++comparisons_cnt;
+            }
+        }
+    });
+    QJsonObject result;
+    result.insert("algorithm", name);
+    result.insert("compute_us_per_image",
+                  compute_seconds * 1e6 / images.size());
+    result.insert("compute_batch_us_per_image",
+                  compute_batch_seconds * 1e6 / images.size());
+    result.insert("compare_per_second", comparisons_cnt / compare_seconds);
+    return result;
+}
+
+static QJsonArray benchmark_hash_algorithms() {
+    std::cerr << "Benchmarking hash algorithms...\n";
+    cv::RNG rng(images_seed);
+    std::vector<cv::Mat> images;
+    for (size_t i = 0; i < images_cnt; ++i) {
+        images.push_back(get_synthetic_image(rng, image_size));
+    }
+    QJsonArray results;
+    results.push_back(benchmark_hash_algorithm(
+        "AverageHash", cv::img_hash::AverageHash::create(), images));
+    results.push_back(benchmark_hash_algorithm(
+        "PHash", cv::img_hash::PHash::create(), images));
+    results.push_back(benchmark_hash_algorithm(
+        "ColorMomentHash", cv::img_hash::ColorMomentHash::create(), images));
+    results.push_back(benchmark_hash_algorithm(
+        "RadialVarianceHash", cv::img_hash::RadialVarianceHash::create(),
+        images));
+    return results;
+}
+
+static QJsonObject benchmark_packed_comparison() {
+    std::cerr << "Benchmarking packed hashes comparison...\n";
+    std::vector<PackedHash> hashes = get_synthetic_hashes(hashes_cnt);
+    std::vector<uint8_t> distances(hashes.size());
+    size_t queries_cnt = 256;
+    double distances_seconds = measure_seconds([&]() {
+        for (size_t i = 0; i < queries_cnt; ++i) {
+            HashHandler::get_hamming_distances(hashes.at(i), hashes.data(),
+                                               hashes.size(),
+                                               distances.data());
+        }
+    });
+    HashHandler hash_handler(cv::img_hash::PHash::create(),
+                             [](double hashes_diff) {
+                                 return hashes_diff <= max_distance;
+                             });
+    size_t matches_cnt = 0;
+    double batch_seconds = measure_seconds([&]() {
+        for (size_t i = 0; i < queries_cnt; ++i) {
+            matches_cnt += hash_handler
+                               .compare_batch(hashes.at(i), hashes.data(),
+                                              hashes.size())
+                               .size();
+        }
+    });
+    QJsonObject result;
+    result.insert("hamming_distances_per_second",
+                  queries_cnt * hashes.size() / distances_seconds);
+    result.insert("compare_batch_per_second",
+                  queries_cnt * hashes.size() / batch_seconds);
+    result.insert("matches", static_cast<qint64>(matches_cnt));
+    return result;
+}
+
+static double benchmark_clustering(const std::vector<PackedHash> &hashes,
+                                   size_t threads_cnt, bool brute_force,
+                                   size_t &clusters_cnt) {
+    ScanSettings settings;
+    settings.max_hashes_distance = max_distance;
+    settings.threads_cnt = threads_cnt;
+    settings.brute_force = brute_force;
+    SimilarImagesScanner scanner(settings);
+    HashesPool hashes_pool = get_hashes_pool(hashes);
+    return measure_seconds([&]() {
+        clusters_cnt =
+            scanner.get_similarity_clusters(std::move(hashes_pool)).size();
+    });
+}
+
+static QJsonArray benchmark_clustering(size_t threads_cnt) {
+    QJsonArray results;
+    for (size_t pool_size : pool_sizes) {
+        std::cerr << "Benchmarking clustering of " << pool_size
+                  << " hashes...\n";
+        std::vector<PackedHash> hashes = get_synthetic_hashes(pool_size);
+        QJsonObject result;
+        result.insert("pool_size", static_cast<qint64>(pool_size));
+        size_t clusters_cnt = 0;
+        result.insert("index_seconds",
+                      benchmark_clustering(hashes, 1, false, clusters_cnt));
+        result.insert("index_parallel_seconds",
+                      benchmark_clustering(hashes, threads_cnt, false,
+                                           clusters_cnt));
+        result.insert("clusters", static_cast<qint64>(clusters_cnt));
+        if (pool_size <= max_brute_force_pool_size) {
+            result.insert("brute_force_seconds",
+                          benchmark_clustering(hashes, 1, true, clusters_cnt));
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+static QJsonObject benchmark_key_frames(const QString &video_filename,
+                                        size_t threads_cnt,
+                                        size_t sampling_step) {
+    ExtractionSettings settings;
+    settings.threads_cnt = threads_cnt;
+    settings.sampling_step = sampling_step;
+    size_t key_frames_cnt = 0;
+    double seconds = measure_seconds([&]() {
+        key_frames_cnt = locate_key_frames(video_filename, settings).size();
+    });
+    QJsonObject result;
+    result.insert("threads", static_cast<qint64>(threads_cnt));
+    result.insert("sampling_step", static_cast<qint64>(sampling_step));
+    result.insert("frames_per_second", video_frames_cnt / seconds);
+    result.insert("key_frames", static_cast<qint64>(key_frames_cnt));
+    return result;
+}
+
+static QJsonArray benchmark_key_frames(size_t threads_cnt) {
+    std::cerr << "Benchmarking key frames location...\n";
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        throw std::runtime_error("Unable to create a temporary directory.");
+    }
+    QString video_filename = directory.filePath("synthetic.avi");
+    write_synthetic_video(video_filename);
+    QJsonArray results;
+    results.push_back(benchmark_key_frames(video_filename, 1, 1));
+    results.push_back(benchmark_key_frames(video_filename, threads_cnt, 1));
+    results.push_back(benchmark_key_frames(video_filename, 1, 8));
+    // locating key frames reports its progress to the standard output
+    std::cout << "\n";
+    return results;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("img-hash-tools-benchmarks");
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption output_filename_option(
+        "o", "Sets output JSON filename.", "output filename",
+        "benchmarks.json");
+    parser.addOption(output_filename_option);
+    QCommandLineOption threads_option(
+        "j", "Sets threads count for the parallel runs.", "threads",
+        QString::number(std::max(1u, std::thread::hardware_concurrency())));
+    parser.addOption(threads_option);
+    parser.process(app);
+    try {
+        size_t threads_cnt =
+            std::max(1u, parser.value(threads_option).toUInt());
+        QJsonObject root;
+        root.insert("cpu", QSysInfo::currentCpuArchitecture());
+        root.insert("threads", static_cast<qint64>(threads_cnt));
+        root.insert("hash_algorithms", benchmark_hash_algorithms());
+        root.insert("packed_comparison", benchmark_packed_comparison());
+        root.insert("clustering", benchmark_clustering(threads_cnt));
+        root.insert("key_frames", benchmark_key_frames(threads_cnt));
+        QFile file(parser.value(output_filename_option));
+        QByteArray data = QJsonDocument(root).toJson();
+        if (!file.open(QIODevice::WriteOnly) ||
+            file.write(data) != data.size()) {
+            throw std::runtime_error("Unable to write '" +
+                                     file.fileName().toStdString() + "'.");
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,71 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Blocking FIFO queue over a preallocated ring buffer linking producer and
+// consumer threads. Closing the queue wakes up all the waiting threads.
+template <typename T> class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity);
+    // blocks while the queue is full, returns false if the queue is closed
+    bool push(T item);
+    // blocks while the queue is empty, returns false if the queue is closed
+    // and drained
+    bool pop(T &item);
+    void close();
+
+private:
+    std::vector<T> slots;
+    size_t head;
+    size_t items_cnt;
+    bool is_closed;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+    : slots(capacity), head(0), items_cnt(0), is_closed(false) {}
+
+template <typename T> bool BoundedQueue<T>::push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock,
+                  [this]() { return is_closed || items_cnt < slots.size(); });
+    if (is_closed) {
+        return false;
+    }
+    slots.at((head + items_cnt) % slots.size()) = std::move(item);
+    ++items_cnt;
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+}
+
+template <typename T> bool BoundedQueue<T>::pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return is_closed || items_cnt > 0; });
+    if (items_cnt == 0) {
+        return false;
+    }
+    item = std::move(slots.at(head));
+    head = (head + 1) % slots.size();
+    --items_cnt;
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+}
+
+template <typename T> void BoundedQueue<T>::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+}
+
+#endif // BOUNDED_QUEUE_HPP
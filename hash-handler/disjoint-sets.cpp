@@ -0,0 +1,50 @@
+#include "disjoint-sets.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+DisjointSets::DisjointSets(size_t elements_cnt) : parents(elements_cnt) {
+    if (elements_cnt > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("Too many elements for disjoint sets.");
+    }
+    for (size_t i = 0; i < elements_cnt; ++i) {
+        parents.at(i).store(i, std::memory_order_relaxed);
+    }
+}
+
+size_t DisjointSets::find(size_t element) {
+    uint32_t curr = element;
+    while (true) {
+        uint32_t parent = parents.at(curr).load();
+        if (parent == curr) {
+            return curr;
+        }
+        uint32_t grandparent = parents.at(parent).load();
+        // path halving, losing the race to another thread is harmless since
+        // parents only ever move closer to the root
+        if (parent != grandparent) {
+            parents.at(curr).compare_exchange_weak(parent, grandparent);
+        }
+        curr = grandparent;
+    }
+}
+
+void DisjointSets::unite(size_t a, size_t b) {
+    while (true) {
+        uint32_t root_a = find(a);
+        uint32_t root_b = find(b);
+        if (root_a == root_b) {
+            return;
+        }
+        if (root_a < root_b) {
+            std::swap(root_a, root_b);
+        }
+        // fails if root_a has been linked by another thread meanwhile
+        if (parents.at(root_a).compare_exchange_strong(root_a, root_b)) {
+            return;
+        }
+    }
+}
+
+size_t DisjointSets::size() const { return parents.size(); }
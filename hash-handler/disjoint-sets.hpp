@@ -0,0 +1,24 @@
+#ifndef DISJOINT_SETS_HPP
+#define DISJOINT_SETS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lock-free union-find over the elements 0..elements_cnt-1, safe to call from
+// several threads at once. A root is always linked under the smaller root,
+// so every set ends up represented by its smallest element regardless of
+// the order of unions.
+class DisjointSets {
+public:
+    explicit DisjointSets(size_t elements_cnt);
+    size_t find(size_t element);
+    void unite(size_t a, size_t b);
+    size_t size() const;
+
+private:
+    std::vector<std::atomic<uint32_t>> parents;
+};
+
+#endif // DISJOINT_SETS_HPP
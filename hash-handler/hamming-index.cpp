@@ -0,0 +1,77 @@
+#include "hamming-index.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+static const size_t hash_bits_cnt = sizeof(PackedHash) * 8;
+
+HammingIndex::HammingIndex(const std::vector<PackedHash> &hashes,
+                           size_t max_distance)
+    : hashes(hashes), max_distance(max_distance) {
+    if (max_distance >= hash_bits_cnt) {
+        throw std::invalid_argument(
+            "Hamming index distance must be less than hash bits count.");
+    }
+    if (hashes.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("Too many hashes to index.");
+    }
+    size_t substrings_cnt = max_distance + 1;
+    unsigned shift = 0;
+    for (size_t i = 0; i < substrings_cnt; ++i) {
+        // spread the remainder over the first substrings
+        unsigned width = hash_bits_cnt / substrings_cnt +
+                         (i < hash_bits_cnt % substrings_cnt ? 1 : 0);
+        Substring substring;
+        substring.shift = shift;
+        substring.mask = width == hash_bits_cnt
+                             ? std::numeric_limits<PackedHash>::max()
+                             : (PackedHash(1) << width) - 1;
+        substring.idxs.resize(hashes.size());
+        std::iota(substring.idxs.begin(), substring.idxs.end(), uint32_t(0));
+        std::sort(substring.idxs.begin(), substring.idxs.end(),
+                  [this, &substring](uint32_t a, uint32_t b) {
+                      PackedHash a_value = get_value(substring, a);
+                      PackedHash b_value = get_value(substring, b);
+                      return a_value < b_value ||
+                             (a_value == b_value && a < b);
+                  });
+        substrings.push_back(std::move(substring));
+        shift += width;
+    }
+}
+
+std::vector<size_t> HammingIndex::find_neighbours(PackedHash hash) const {
+    std::vector<size_t> neighbours;
+    for (const auto &substring : substrings) {
+        PackedHash value = (hash >> substring.shift) & substring.mask;
+        auto first = std::lower_bound(
+            substring.idxs.begin(), substring.idxs.end(), value,
+            [this, &substring](uint32_t idx, PackedHash value) {
+                return get_value(substring, idx) < value;
+            });
+        auto last = std::upper_bound(
+            first, substring.idxs.end(), value,
+            [this, &substring](PackedHash value, uint32_t idx) {
+                return value < get_value(substring, idx);
+            });
+        for (auto it = first; it != last; ++it) {
+            size_t distance =
+                HashHandler::get_hamming_distance(hash, hashes.at(*it));
+            if (distance <= max_distance) {
+                neighbours.push_back(*it);
+            }
+        }
+    }
+    // a neighbour matching on several substrings is found several times
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                     neighbours.end());
+    return neighbours;
+}
+
+PackedHash HammingIndex::get_value(const Substring &substring,
+                                   uint32_t idx) const {
+    return (hashes[idx] >> substring.shift) & substring.mask;
+}
@@ -0,0 +1,40 @@
+#ifndef HAMMING_INDEX_HPP
+#define HAMMING_INDEX_HPP
+
+#include "hash-handler.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Multi-index hashing over packed hashes. The bits are split into
+// (max_distance + 1) disjoint substrings, so by the pigeonhole principle any
+// hash within max_distance of a query matches it exactly on at least one
+// substring. Only the hashes sharing a substring are checked then. The hashes
+// are referenced rather than copied, every substring only adds a 32-bit index
+// per hash.
+class HammingIndex {
+public:
+    // the hashes have to outlive the index
+    HammingIndex(const std::vector<PackedHash> &hashes, size_t max_distance);
+    HammingIndex(std::vector<PackedHash> &&hashes,
+                 size_t max_distance) = delete;
+    // indices of all the indexed hashes within max_distance, ascending
+    std::vector<size_t> find_neighbours(PackedHash hash) const;
+
+private:
+    struct Substring {
+        unsigned shift;
+        PackedHash mask;
+        // hash indices sorted by substring value, the value is extracted
+        // from the hash on every comparison
+        std::vector<uint32_t> idxs;
+    };
+
+    PackedHash get_value(const Substring &substring, uint32_t idx) const;
+
+    const std::vector<PackedHash> &hashes;
+    const size_t max_distance;
+    std::vector<Substring> substrings;
+};
+
+#endif // HAMMING_INDEX_HPP
@@ -1,17 +1,363 @@
 #include "hash-handler.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+static const size_t hash_bytes_cnt = 8;
+// PHash takes the lowest 8x8 DCT frequencies of a 32x32 thumbnail
+static const int phash_thumbnail_side = 32;
+static const int phash_frequencies_cnt = 8;
+
+// Rows of the orthonormal DCT-II matrix for the lowest frequencies, same
+// scaling as cv::dct. The 2D transform of a thumbnail X restricted to these
+// frequencies is D * X * D^T.
+static const cv::Mat &get_phash_dct_matrix() {
+    static const cv::Mat dct_matrix = []() {
+        cv::Mat matrix(phash_frequencies_cnt, phash_thumbnail_side, CV_32F);
+        for (int k = 0; k < matrix.rows; ++k) {
+            double scale = std::sqrt((k == 0 ? 1. : 2.) / matrix.cols);
+            for (int n = 0; n < matrix.cols; ++n) {
+                matrix.at<float>(k, n) = static_cast<float>(
+                    scale * std::cos(CV_PI * (2 * n + 1) * k /
+                                     (2. * matrix.cols)));
+            }
+        }
+        return matrix;
+    }();
+    return dct_matrix;
+}
+
+// bit k of byte j is set if the element (j, k) of the 8x8 block is above
+// the threshold, same layout as cv::img_hash
+template <typename T>
+static void pack_bits(const cv::Mat &block, T threshold, uchar *hash) {
+    for (int j = 0; j < block.rows; ++j) {
+        const T *row = block.ptr<T>(j);
+        uchar byte = 0;
+        for (int k = 0; k < block.cols; ++k) {
+            byte |= static_cast<uchar>(row[k] > threshold) << k;
+        }
+        hash[j] = byte;
+    }
+}
+
 HashHandler::HashHandler(
     const cv::Ptr<cv::img_hash::ImgHashBase> &hash_algorithm,
     const std::function<bool(double)> &thresholding_predicate)
     : hash_algorithm(hash_algorithm),
-      thresholding_predicate(thresholding_predicate) {}
+      thresholding_predicate(thresholding_predicate),
+      algorithm(get_algorithm(hash_algorithm)) {
+    for (size_t i = 0; i < packed_thresholding_table.size(); ++i) {
+        packed_thresholding_table.at(i) = thresholding_predicate(i);
+    }
+}
 
 cv::Mat HashHandler::compute(const cv::Mat &img) {
     cv::Mat hash;
-    hash_algorithm->compute(img, hash);
+    compute(img, hash);
     return hash;
 }
 
+void HashHandler::compute(const cv::Mat &img, cv::Mat &hash) {
+    // a single image goes through the batched implementation as well, so
+    // that a hash never depends on how it was computed
+    if (is_batchable(&img, 1)) {
+        compute_batch(&img, 1, hash);
+        return;
+    }
+    ProfileScope profile_scope("compute");
+    hash_algorithm->compute(img, hash);
+}
+
+void HashHandler::compute(PreprocessedImage &img, cv::Mat &hash) {
+    const cv::Mat &src = img.get_img();
+    // the types accepted by cv::img_hash
+    bool is_supported = src.type() == CV_8UC1 || src.type() == CV_8UC3 ||
+                        src.type() == CV_8UC4;
+    if (algorithm == Algorithm::phash && is_supported &&
+        src.size() == cv::Size(phash_thumbnail_side, phash_thumbnail_side)) {
+        // resizing keeps a thumbnail of this size as it is, so converting it
+        // to gray first changes nothing
+        compute(img.get_gray(), hash);
+        return;
+    }
+    if (algorithm == Algorithm::radial_variance_hash && is_supported) {
+        // the first step of RadialVarianceHash is the same gray conversion
+        ProfileScope profile_scope("compute");
+        hash_algorithm->compute(img.get_gray(), hash);
+        return;
+    }
+    if (algorithm == Algorithm::color_moment_hash && is_supported) {
+        ProfileScope profile_scope("compute");
+        compute_color_moment_hash(img, hash);
+        return;
+    }
+    compute(src, hash);
+}
+
+void HashHandler::compute_batch(const cv::Mat *imgs, size_t imgs_cnt,
+                                cv::Mat &hashes) {
+    ProfileScope profile_scope("compute", imgs_cnt);
+    if (imgs_cnt == 0) {
+        hashes.release();
+        return;
+    }
+    if (!is_batchable(imgs, imgs_cnt)) {
+        cv::Mat hash;
+        for (size_t i = 0; i < imgs_cnt; ++i) {
+            hash_algorithm->compute(imgs[i], hash);
+            if (i == 0) {
+                hashes.create(imgs_cnt, hash.total(), hash.type());
+            }
+            hash.reshape(1, 1).copyTo(hashes.row(i));
+        }
+        return;
+    }
+    hashes.create(imgs_cnt, hash_bytes_cnt, CV_8U);
+    if (algorithm == Algorithm::average_hash) {
+        compute_average_hashes(imgs, imgs_cnt, hashes);
+    } else {
+        compute_phashes(imgs, imgs_cnt, hashes);
+    }
+}
+
 bool HashHandler::compare(const cv::Mat &hash_a, const cv::Mat &hash_b) const {
+    ProfileScope profile_scope("compare");
     return thresholding_predicate(hash_algorithm->compare(hash_a, hash_b));
 }
+
+bool HashHandler::compare(PackedHash hash_a, PackedHash hash_b) const {
+    return packed_thresholding_table[get_hamming_distance(hash_a, hash_b)];
+}
+
+std::vector<size_t> HashHandler::compare_batch(PackedHash query,
+                                               const PackedHash *hashes,
+                                               size_t hashes_cnt) const {
+    ProfileScope profile_scope("compare batch", hashes_cnt);
+    static const size_t chunk_size = 1024;
+    std::array<uint8_t, chunk_size> distances;
+    std::vector<size_t> matches;
+    for (size_t i = 0; i < hashes_cnt; i += chunk_size) {
+        size_t cnt = std::min(chunk_size, hashes_cnt - i);
+        get_hamming_distances(query, hashes + i, cnt, distances.data());
+        for (size_t j = 0; j < cnt; ++j) {
+            if (packed_thresholding_table[distances[j]]) {
+                matches.push_back(i + j);
+            }
+        }
+    }
+    return matches;
+}
+
+HashHandler::Algorithm HashHandler::get_algorithm(
+    const cv::Ptr<cv::img_hash::ImgHashBase> &hash_algorithm) {
+    if (!hash_algorithm.dynamicCast<cv::img_hash::AverageHash>().empty()) {
+        return Algorithm::average_hash;
+    }
+    if (!hash_algorithm.dynamicCast<cv::img_hash::PHash>().empty()) {
+        return Algorithm::phash;
+    }
+    if (!hash_algorithm.dynamicCast<cv::img_hash::ColorMomentHash>().empty()) {
+        return Algorithm::color_moment_hash;
+    }
+    if (!hash_algorithm.dynamicCast<cv::img_hash::RadialVarianceHash>()
+             .empty()) {
+        return Algorithm::radial_variance_hash;
+    }
+    return Algorithm::other;
+}
+
+bool HashHandler::is_batchable(const cv::Mat *imgs, size_t imgs_cnt) const {
+    if (algorithm != Algorithm::average_hash &&
+        algorithm != Algorithm::phash) {
+        return false;
+    }
+    for (size_t i = 0; i < imgs_cnt; ++i) {
+        // the types accepted by cv::img_hash
+        if (imgs[i].type() != CV_8UC1 && imgs[i].type() != CV_8UC3 &&
+            imgs[i].type() != CV_8UC4) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HashHandler::prepare_gray_thumbnail(const cv::Mat &img,
+                                         const cv::Size &size) {
+    // the order of steps follows cv::img_hash
+    cv::resize(img, resized_img, size, 0, 0, cv::INTER_LINEAR_EXACT);
+    if (resized_img.channels() > 1) {
+        cv::cvtColor(resized_img, gray_img, cv::COLOR_BGR2GRAY);
+    } else {
+        gray_img = resized_img;
+    }
+}
+
+void HashHandler::compute_average_hashes(const cv::Mat *imgs,
+                                         size_t imgs_cnt, cv::Mat &hashes) {
+    // gray 8x8 thumbnails as rows, averaged by a single reduction
+    thumbnails.create(imgs_cnt, hash_bytes_cnt * 8, CV_8U);
+    for (size_t i = 0; i < imgs_cnt; ++i) {
+        prepare_gray_thumbnail(imgs[i], cv::Size(8, 8));
+        gray_img.reshape(1, 1).copyTo(thumbnails.row(i));
+    }
+    cv::reduce(thumbnails, row_transformed, 1, cv::REDUCE_SUM, CV_32S);
+    for (size_t i = 0; i < imgs_cnt; ++i) {
+        auto mean = static_cast<uchar>(cvRound(
+            static_cast<double>(row_transformed.at<int>(i)) /
+            thumbnails.cols));
+        pack_bits<uchar>(thumbnails.row(i).reshape(1, 8), mean,
+                         hashes.ptr<uchar>(i));
+    }
+}
+
+void HashHandler::compute_phashes(const cv::Mat *imgs, size_t imgs_cnt,
+                                  cv::Mat &hashes) {
+    // The thumbnails X are stacked and the rows of the whole batch are
+    // transformed by D^T in one pass, then D is applied to every block. The
+    // sums are accumulated in a fixed order, as cv::gemm would block and
+    // accumulate a product of the whole batch differently depending on its
+    // size, which may flip the bits of coefficients close to the mean.
+    const cv::Mat &dct_matrix = get_phash_dct_matrix();
+    const int side = phash_thumbnail_side;
+    const int frequencies_cnt = phash_frequencies_cnt;
+    thumbnails.create(static_cast<int>(imgs_cnt) * side, side, CV_32F);
+    for (size_t i = 0; i < imgs_cnt; ++i) {
+        prepare_gray_thumbnail(imgs[i], cv::Size(side, side));
+        cv::Mat thumbnail = thumbnails.rowRange(i * side, (i + 1) * side);
+        gray_img.convertTo(thumbnail, CV_32F);
+    }
+    row_transformed.create(thumbnails.rows, frequencies_cnt, CV_32F);
+    for (int r = 0; r < thumbnails.rows; ++r) {
+        const float *thumbnail_row = thumbnails.ptr<float>(r);
+        float *transformed_row = row_transformed.ptr<float>(r);
+        for (int k = 0; k < frequencies_cnt; ++k) {
+            const float *dct_row = dct_matrix.ptr<float>(k);
+            float sum = 0;
+            for (int n = 0; n < side; ++n) {
+                sum += thumbnail_row[n] * dct_row[n];
+            }
+            transformed_row[k] = sum;
+        }
+    }
+    dct_coefficients.create(frequencies_cnt, frequencies_cnt, CV_32F);
+    for (size_t i = 0; i < imgs_cnt; ++i) {
+        dct_coefficients.setTo(0);
+        for (int k = 0; k < frequencies_cnt; ++k) {
+            const float *dct_row = dct_matrix.ptr<float>(k);
+            float *coefficients_row = dct_coefficients.ptr<float>(k);
+            for (int n = 0; n < side; ++n) {
+                const float *transformed_row =
+                    row_transformed.ptr<float>(i * side + n);
+                for (int l = 0; l < frequencies_cnt; ++l) {
+                    coefficients_row[l] += dct_row[n] * transformed_row[l];
+                }
+            }
+        }
+        // the DC coefficient is zeroed before averaging
+        dct_coefficients.at<float>(0, 0) = 0;
+        auto mean = static_cast<float>(cv::mean(dct_coefficients)[0]);
+        pack_bits<float>(dct_coefficients, mean, hashes.ptr<uchar>(i));
+    }
+}
+
+void HashHandler::compute_color_moment_hash(PreprocessedImage &img,
+                                            cv::Mat &hash) {
+    // Hu moments of every channel in HSV and then in YCrCb, as computed by
+    // cv::img_hash::ColorMomentHash
+    static const int hu_moments_cnt = 7;
+    hash.create(1, 2 * 3 * hu_moments_cnt, CV_64F);
+    double *moments = hash.ptr<double>(0);
+    for (const cv::Mat *color_space :
+         {&img.get_color_moment_hsv(), &img.get_color_moment_ycrcb()}) {
+        for (int i = 0; i < color_space->channels(); ++i) {
+            cv::extractChannel(*color_space, channel, i);
+            cv::HuMoments(cv::moments(channel), moments);
+            moments += hu_moments_cnt;
+        }
+    }
+}
+
+size_t HashHandler::get_max_matching_distance() const {
+    size_t distance = 0;
+    if (!packed_thresholding_table.front()) {
+        throw std::logic_error(
+            "Thresholding predicate does not match identical hashes.");
+    }
+    while (distance + 1 < packed_thresholding_table.size() &&
+           packed_thresholding_table.at(distance + 1)) {
+        ++distance;
+    }
+    return distance;
+}
+
+PackedHash HashHandler::pack(const cv::Mat &hash) {
+    PackedHash packed_hash;
+    if (hash.type() != CV_8U || hash.total() != sizeof(packed_hash) ||
+        !hash.isContinuous()) {
+        throw std::logic_error("Packing hash is forbidden: not 64 bits.");
+    }
+    std::memcpy(&packed_hash, hash.data, sizeof(packed_hash));
+    return packed_hash;
+}
+
+size_t HashHandler::get_hamming_distance(PackedHash hash_a,
+                                         PackedHash hash_b) {
+#ifdef _MSC_VER
+    return __popcnt64(hash_a ^ hash_b);
+#else
+    return __builtin_popcountll(hash_a ^ hash_b);
+#endif
+}
+
+void HashHandler::get_hamming_distances(PackedHash query,
+                                        const PackedHash *hashes,
+                                        size_t hashes_cnt,
+                                        uint8_t *distances) {
+    size_t i = 0;
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    const __m512i query_x8 = _mm512_set1_epi64(query);
+    for (; i + 8 <= hashes_cnt; i += 8) {
+        __m512i counts = _mm512_popcnt_epi64(_mm512_xor_si512(
+            _mm512_loadu_si512(hashes + i), query_x8));
+        _mm512_mask_cvtepi64_storeu_epi8(distances + i, 0xff, counts);
+    }
+#elif defined(__AVX2__)
+    // per-nibble lookup of bit counts, summed up per 64-bit lane
+    const __m256i query_x4 = _mm256_set1_epi64x(query);
+    const __m256i nibble_counts =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0,
+                         1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles_mask = _mm256_set1_epi8(0x0f);
+    for (; i + 4 <= hashes_cnt; i += 4) {
+        __m256i x = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hashes + i)),
+            query_x4);
+        __m256i low_counts = _mm256_shuffle_epi8(
+            nibble_counts, _mm256_and_si256(x, low_nibbles_mask));
+        __m256i high_counts = _mm256_shuffle_epi8(
+            nibble_counts,
+            _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibbles_mask));
+        __m256i counts =
+            _mm256_sad_epu8(_mm256_add_epi8(low_counts, high_counts),
+                            _mm256_setzero_si256());
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), counts);
+        for (size_t j = 0; j < 4; ++j) {
+            distances[i + j] = static_cast<uint8_t>(lanes[j]);
+        }
+    }
+#endif
+    for (; i < hashes_cnt; ++i) {
+        distances[i] =
+            static_cast<uint8_t>(get_hamming_distance(query, hashes[i]));
+    }
+}
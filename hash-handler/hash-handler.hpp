@@ -1,22 +1,86 @@
 #ifndef HASH_HANDLER_HPP
 #define HASH_HANDLER_HPP
 
+#include "preprocessed-image.hpp"
+#include "profiler.hpp"
+
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <queue>
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/img_hash.hpp>
+#include <opencv2/imgproc.hpp>
+
+// 64-bit hashes (AverageHash, PHash) packed into a single word, compared by
+// the Hamming distance
+typedef uint64_t PackedHash;
 
 class HashHandler {
 public:
     HashHandler(const cv::Ptr<cv::img_hash::ImgHashBase> &hash_algorithm,
                 const std::function<bool(double)> &thresholding_predicate);
     cv::Mat compute(const cv::Mat &img);
+    // reuses the hash buffer if it fits
+    void compute(const cv::Mat &img, cv::Mat &hash);
+    // starts from the intermediates shared with other algorithms, the hash
+    // is the same as of the image itself
+    void compute(PreprocessedImage &img, cv::Mat &hash);
+    // hashes of the images as the rows of a single buffer
+    void compute_batch(const cv::Mat *imgs, size_t imgs_cnt, cv::Mat &hashes);
     bool compare(const cv::Mat &hash_a, const cv::Mat &hash_b) const;
+    bool compare(PackedHash hash_a, PackedHash hash_b) const;
+    // indices of the hashes matching the query
+    std::vector<size_t> compare_batch(PackedHash query,
+                                      const PackedHash *hashes,
+                                      size_t hashes_cnt) const;
+    // the largest Hamming distance up to which all packed hashes match
+    size_t get_max_matching_distance() const;
+
+    static PackedHash pack(const cv::Mat &hash);
+    static size_t get_hamming_distance(PackedHash hash_a, PackedHash hash_b);
+    static void get_hamming_distances(PackedHash query,
+                                      const PackedHash *hashes,
+                                      size_t hashes_cnt, uint8_t *distances);
 
 private:
+    // AverageHash and PHash have own implementations working on the whole
+    // batch at once, PHash bits may differ from cv::img_hash::PHash in the
+    // rounding of coefficients close to the mean. Others are computed by
+    // OpenCV image by image unless they start from a preprocessed image
+    enum class Algorithm {
+        other,
+        average_hash,
+        phash,
+        color_moment_hash,
+        radial_variance_hash
+    };
+
+    static Algorithm
+    get_algorithm(const cv::Ptr<cv::img_hash::ImgHashBase> &hash_algorithm);
+    bool is_batchable(const cv::Mat *imgs, size_t imgs_cnt) const;
+    void compute_average_hashes(const cv::Mat *imgs, size_t imgs_cnt,
+                                cv::Mat &hashes);
+    void compute_phashes(const cv::Mat *imgs, size_t imgs_cnt,
+                         cv::Mat &hashes);
+    void prepare_gray_thumbnail(const cv::Mat &img, const cv::Size &size);
+    void compute_color_moment_hash(PreprocessedImage &img, cv::Mat &hash);
+
+    static const size_t packed_hash_bits_cnt = 64;
+
     const cv::Ptr<cv::img_hash::ImgHashBase> hash_algorithm;
     const std::function<bool(double)> thresholding_predicate;
+    // thresholding predicate evaluated for every Hamming distance
+    std::array<bool, packed_hash_bits_cnt + 1> packed_thresholding_table;
+    const Algorithm algorithm;
+    // buffers reused between batches
+    cv::Mat resized_img;
+    cv::Mat gray_img;
+    cv::Mat thumbnails;
+    cv::Mat row_transformed;
+    cv::Mat dct_coefficients;
+    cv::Mat channel;
 };
 
 #endif // HASH_HANDLER_HPP
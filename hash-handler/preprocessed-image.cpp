@@ -0,0 +1,84 @@
+#include "preprocessed-image.hpp"
+
+#include "profiler.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+static const cv::Size color_moment_size(512, 512);
+static const cv::Size color_moment_blur_size(3, 3);
+
+PreprocessedImage::PreprocessedImage() { release(); }
+
+void PreprocessedImage::reset(const cv::Mat &img) {
+    this->img = img;
+    is_gray_computed = false;
+    is_color_moment_blurred_computed = false;
+    is_color_moment_hsv_computed = false;
+    is_color_moment_ycrcb_computed = false;
+}
+
+void PreprocessedImage::release() {
+    // the buffers are kept for the next image
+    reset(cv::Mat());
+}
+
+bool PreprocessedImage::empty() const { return img.empty(); }
+
+const cv::Mat &PreprocessedImage::get_img() const { return img; }
+
+const cv::Mat &PreprocessedImage::get_gray() {
+    // the gray buffer never shares the image, so that converting the next
+    // image does not overwrite this one
+    if (img.type() != CV_8UC3 && img.type() != CV_8UC4) {
+        return img;
+    }
+    if (!is_gray_computed) {
+        ProfileScope profile_scope("preprocess");
+        cv::cvtColor(img, gray,
+                     img.type() == CV_8UC3 ? cv::COLOR_BGR2GRAY
+                                           : cv::COLOR_BGRA2GRAY);
+        is_gray_computed = true;
+    }
+    return gray;
+}
+
+const cv::Mat &PreprocessedImage::get_color_moment_hsv() {
+    if (!is_color_moment_hsv_computed) {
+        const cv::Mat &blurred = get_color_moment_blurred();
+        ProfileScope profile_scope("preprocess");
+        cv::cvtColor(blurred, color_moment_hsv, cv::COLOR_BGR2HSV);
+        is_color_moment_hsv_computed = true;
+    }
+    return color_moment_hsv;
+}
+
+const cv::Mat &PreprocessedImage::get_color_moment_ycrcb() {
+    if (!is_color_moment_ycrcb_computed) {
+        const cv::Mat &blurred = get_color_moment_blurred();
+        ProfileScope profile_scope("preprocess");
+        cv::cvtColor(blurred, color_moment_ycrcb, cv::COLOR_BGR2YCrCb);
+        is_color_moment_ycrcb_computed = true;
+    }
+    return color_moment_ycrcb;
+}
+
+const cv::Mat &PreprocessedImage::get_color_moment_blurred() {
+    if (is_color_moment_blurred_computed) {
+        return color_moment_blurred;
+    }
+    ProfileScope profile_scope("preprocess");
+    const cv::Mat *bgr_img = &img;
+    if (img.type() == CV_8UC4) {
+        cv::cvtColor(img, bgr, cv::COLOR_BGRA2BGR);
+        bgr_img = &bgr;
+    } else if (img.type() == CV_8UC1) {
+        cv::cvtColor(img, bgr, cv::COLOR_GRAY2BGR);
+        bgr_img = &bgr;
+    }
+    cv::resize(*bgr_img, color_moment_resized, color_moment_size, 0, 0,
+               cv::INTER_CUBIC);
+    cv::GaussianBlur(color_moment_resized, color_moment_blurred,
+                     color_moment_blur_size, 0, 0);
+    is_color_moment_blurred_computed = true;
+    return color_moment_blurred;
+}
@@ -0,0 +1,38 @@
+#ifndef PREPROCESSED_IMAGE_HPP
+#define PREPROCESSED_IMAGE_HPP
+
+#include <opencv2/core.hpp>
+
+// Intermediates of an image shared by the hash algorithms. Every one is
+// computed on the first request after a reset, into buffers which are reused
+// for the next images, and matches the corresponding step of cv::img_hash.
+class PreprocessedImage {
+public:
+    PreprocessedImage();
+    // shares the image, which must stay unchanged until the next reset
+    void reset(const cv::Mat &img);
+    void release();
+    bool empty() const;
+    const cv::Mat &get_img() const;
+    const cv::Mat &get_gray();
+    // ColorMomentHash looks at a blurred 512x512 upscale in both spaces
+    const cv::Mat &get_color_moment_hsv();
+    const cv::Mat &get_color_moment_ycrcb();
+
+private:
+    const cv::Mat &get_color_moment_blurred();
+
+    cv::Mat img;
+    cv::Mat gray;
+    cv::Mat bgr;
+    cv::Mat color_moment_resized;
+    cv::Mat color_moment_blurred;
+    cv::Mat color_moment_hsv;
+    cv::Mat color_moment_ycrcb;
+    bool is_gray_computed;
+    bool is_color_moment_blurred_computed;
+    bool is_color_moment_hsv_computed;
+    bool is_color_moment_ycrcb_computed;
+};
+
+#endif // PREPROCESSED_IMAGE_HPP
@@ -0,0 +1,128 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+
+std::atomic<bool> Profiler::enabled(false);
+bool Profiler::is_tracing = false;
+std::chrono::steady_clock::time_point Profiler::enabling_time;
+std::mutex Profiler::recorders_mutex;
+std::vector<std::unique_ptr<Profiler::ThreadRecorder>> Profiler::recorders;
+
+static std::string get_json_string(const std::string &str) {
+    std::string res = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+        }
+        res += c;
+    }
+    return res + "\"";
+}
+
+static double get_microseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Profiler::enable(bool is_tracing) {
+    Profiler::is_tracing = is_tracing;
+    enabling_time = std::chrono::steady_clock::now();
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::record(const char *step_name,
+                      std::chrono::steady_clock::time_point start_time,
+                      std::chrono::steady_clock::time_point end_time,
+                      size_t items_cnt, size_t bytes_cnt) {
+    ThreadRecorder &recorder = get_thread_recorder();
+    StepStats &step = recorder.steps[step_name];
+    ++step.calls;
+    step.items += items_cnt;
+    step.bytes += bytes_cnt;
+    step.time += end_time - start_time;
+    if (is_tracing) {
+        recorder.events.push_back(TraceEvent{step_name, start_time,
+                                             end_time - start_time, items_cnt,
+                                             bytes_cnt});
+    }
+}
+
+void Profiler::print_summary(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(recorders_mutex);
+    // the same literal may have several addresses across translation units
+    std::map<std::string, StepStats> steps;
+    for (const auto &recorder : recorders) {
+        for (const auto &[step_name, step] : recorder->steps) {
+            StepStats &merged_step = steps[step_name];
+            merged_step.calls += step.calls;
+            merged_step.items += step.items;
+            merged_step.bytes += step.bytes;
+            merged_step.time += step.time;
+        }
+    }
+    std::vector<std::pair<std::string, StepStats>> sorted_steps(steps.begin(),
+                                                                steps.end());
+    std::stable_sort(sorted_steps.begin(), sorted_steps.end(),
+                     [](const auto &a, const auto &b) {
+                         return a.second.time > b.second.time;
+                     });
+    out << "Profile (time summed over " << recorders.size()
+        << " threads):\n";
+    for (const auto &[step_name, step] : sorted_steps) {
+        double seconds = get_microseconds(step.time) / 1e6;
+        out << "  " << std::left << std::setw(24) << step_name << std::right
+            << std::fixed << std::setprecision(1) << std::setw(10)
+            << seconds * 1e3 << " ms" << std::setw(12) << step.calls
+            << " calls" << std::setw(12) << step.items << " items";
+        if (step.bytes > 0) {
+            out << std::setw(10) << step.bytes / 1e6 << " MB";
+        }
+        if (seconds > 0) {
+            out << std::setw(12) << step.items / seconds << " items/s";
+        }
+        out << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+void Profiler::write_trace(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(recorders_mutex);
+    std::ofstream out(filename);
+    if (!out) {
+        throw std::runtime_error("Unable to write '" + filename + "'.");
+    }
+    out << "{\"traceEvents\":[";
+    bool is_first = true;
+    out << std::fixed << std::setprecision(3);
+    for (const auto &recorder : recorders) {
+        for (const auto &event : recorder->events) {
+            out << (is_first ? "\n" : ",\n") << "{\"name\":"
+                << get_json_string(event.step_name)
+                << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << recorder->thread_idx
+                << ",\"ts\":"
+                << get_microseconds(event.start_time - enabling_time)
+                << ",\"dur\":" << get_microseconds(event.duration)
+                << ",\"args\":{\"items\":" << event.items_cnt
+                << ",\"bytes\":" << event.bytes_cnt << "}}";
+            is_first = false;
+        }
+    }
+    out << "\n]}\n";
+    if (!out) {
+        throw std::runtime_error("Unable to write '" + filename + "'.");
+    }
+}
+
+Profiler::ThreadRecorder &Profiler::get_thread_recorder() {
+    thread_local ThreadRecorder *recorder = nullptr;
+    if (recorder == nullptr) {
+        std::lock_guard<std::mutex> lock(recorders_mutex);
+        recorders.push_back(std::make_unique<ThreadRecorder>());
+        recorders.back()->thread_idx = recorders.size();
+        recorder = recorders.back().get();
+    }
+    return *recorder;
+}
@@ -0,0 +1,94 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Time, items and bytes spent on every step of a run, shared by both tools.
+// Steps are named by string literals. Every thread records into its own
+// buffers, and the results are merged once the work is done. While
+// disabled, a scope costs a single relaxed atomic load.
+class Profiler {
+public:
+    // call before any scope starts
+    static void enable(bool is_tracing);
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+    static void record(const char *step_name,
+                       std::chrono::steady_clock::time_point start_time,
+                       std::chrono::steady_clock::time_point end_time,
+                       size_t items_cnt, size_t bytes_cnt);
+    // call after all the scopes ended
+    static void print_summary(std::ostream &out);
+    // Chrome trace event format, viewable in chrome://tracing or Perfetto
+    static void write_trace(const std::string &filename);
+
+private:
+    struct StepStats {
+        size_t calls;
+        size_t items;
+        size_t bytes;
+        std::chrono::nanoseconds time;
+    };
+
+    struct TraceEvent {
+        const char *step_name;
+        std::chrono::steady_clock::time_point start_time;
+        std::chrono::nanoseconds duration;
+        size_t items_cnt;
+        size_t bytes_cnt;
+    };
+
+    struct ThreadRecorder {
+        size_t thread_idx;
+        std::unordered_map<const char *, StepStats> steps;
+        std::vector<TraceEvent> events;
+    };
+
+    static ThreadRecorder &get_thread_recorder();
+
+    static std::atomic<bool> enabled;
+    static bool is_tracing;
+    static std::chrono::steady_clock::time_point enabling_time;
+    static std::mutex recorders_mutex;
+    static std::vector<std::unique_ptr<ThreadRecorder>> recorders;
+};
+
+// Records the time from construction to destruction as one call of a step.
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *step_name, size_t items_cnt = 1)
+        : step_name(step_name), items_cnt(items_cnt), bytes_cnt(0),
+          is_enabled(Profiler::is_enabled()) {
+        if (is_enabled) {
+            start_time = std::chrono::steady_clock::now();
+        }
+    }
+    ~ProfileScope() {
+        if (is_enabled) {
+            Profiler::record(step_name, start_time,
+                             std::chrono::steady_clock::now(), items_cnt,
+                             bytes_cnt);
+        }
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    void set_items(size_t items_cnt) { this->items_cnt = items_cnt; }
+    void add_bytes(size_t bytes_cnt) { this->bytes_cnt += bytes_cnt; }
+
+private:
+    const char *step_name;
+    size_t items_cnt;
+    size_t bytes_cnt;
+    const bool is_enabled;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+#endif // PROFILER_HPP
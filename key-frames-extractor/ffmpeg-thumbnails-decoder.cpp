@@ -0,0 +1,210 @@
+#include "ffmpeg-thumbnails-decoder.hpp"
+
+#include <hash-handler/profiler.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+#include <cmath>
+#include <stdexcept>
+
+// decoded frames stay at least this many times larger than the thumbnails
+static const int min_lowres_scale = 4;
+// frames by which a seek steps back further when it lands past the target
+static const size_t initial_seek_back = 16;
+
+FfmpegThumbnailsDecoder::FfmpegThumbnailsDecoder(
+    const QString &filename, const cv::Size &thumbnail_size,
+    size_t threads_cnt)
+    : filename(filename), thumbnail_size(thumbnail_size),
+      format_ctx(nullptr), codec_ctx(nullptr), packet(av_packet_alloc()),
+      frame(av_frame_alloc()), sws_ctx(nullptr), stream_idx(-1), fps(0),
+      first_frame_num(0), is_seeking(false), is_draining(false),
+      is_packet_pending(false) {
+    auto throw_unable_to_open = [this]() {
+        release();
+        throw std::runtime_error(
+            "Unable to open '" + this->filename.toStdString() +
+            "'. Not a video or video format is not supproted.");
+    };
+    if (packet == nullptr || frame == nullptr ||
+        avformat_open_input(&format_ctx, filename.toUtf8().constData(),
+                            nullptr, nullptr) < 0 ||
+        avformat_find_stream_info(format_ctx, nullptr) < 0) {
+        throw_unable_to_open();
+    }
+    const AVCodec *codec = nullptr;
+    stream_idx = av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1,
+                                     &codec, 0);
+    if (stream_idx < 0 ||
+        (codec_ctx = avcodec_alloc_context3(codec)) == nullptr ||
+        avcodec_parameters_to_context(
+            codec_ctx, format_ctx->streams[stream_idx]->codecpar) < 0) {
+        throw_unable_to_open();
+    }
+    const AVStream *stream = format_ctx->streams[stream_idx];
+    fps = av_q2d(stream->avg_frame_rate);
+    if (fps <= 0) {
+        fps = av_q2d(stream->r_frame_rate);
+    }
+    codec_ctx->thread_count = threads_cnt;
+    codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+    codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    int lowres = 0;
+    while (lowres < codec->max_lowres &&
+           (codec_ctx->width >> (lowres + 1)) >=
+               thumbnail_size.width * min_lowres_scale &&
+           (codec_ctx->height >> (lowres + 1)) >=
+               thumbnail_size.height * min_lowres_scale) {
+        ++lowres;
+    }
+    codec_ctx->lowres = lowres;
+    if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+        throw_unable_to_open();
+    }
+}
+
+FfmpegThumbnailsDecoder::~FfmpegThumbnailsDecoder() { release(); }
+
+void FfmpegThumbnailsDecoder::release() {
+    sws_freeContext(sws_ctx);
+    sws_ctx = nullptr;
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+}
+
+void FfmpegThumbnailsDecoder::seek(size_t frame_num) {
+    // a seek lands on the key frame preceding the timestamp, which for some
+    // containers is still past the target, then it steps back further
+    for (size_t seek_back = 0;;
+         seek_back = seek_back * 2 + initial_seek_back) {
+        size_t seek_frame_num =
+            frame_num > seek_back ? frame_num - seek_back : 0;
+        seek_timestamp(seek_frame_num);
+        if (seek_frame_num == 0 || !decode_next_frame() ||
+            get_frame_num() <= frame_num) {
+            break;
+        }
+    }
+    first_frame_num = frame_num;
+    is_seeking = true;
+}
+
+bool FfmpegThumbnailsDecoder::read(cv::Mat &thumbnail, size_t &frame_num) {
+    if (is_seeking) {
+        // the frame decoded while seeking is checked first
+        while (frame->data[0] == nullptr || get_frame_num() < first_frame_num) {
+            if (!decode_next_frame()) {
+                return false;
+            }
+        }
+        is_seeking = false;
+    } else if (!decode_next_frame()) {
+        return false;
+    }
+    ProfileScope profile_scope("resize");
+    sws_ctx = sws_getCachedContext(
+        sws_ctx, frame->width, frame->height,
+        static_cast<AVPixelFormat>(frame->format), thumbnail_size.width,
+        thumbnail_size.height, AV_PIX_FMT_BGR24, SWS_AREA, nullptr, nullptr,
+        nullptr);
+    if (sws_ctx == nullptr) {
+        throw std::runtime_error("Unable to scale frames of '" +
+                                 filename.toStdString() + "'.");
+    }
+    thumbnail.create(thumbnail_size, CV_8UC3);
+    uint8_t *dst_data[] = {thumbnail.data};
+    int dst_linesize[] = {static_cast<int>(thumbnail.step[0])};
+    sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height,
+              dst_data, dst_linesize);
+    frame_num = get_frame_num();
+    return true;
+}
+
+bool FfmpegThumbnailsDecoder::decode_next_frame() {
+    ProfileScope profile_scope("decode");
+    av_frame_unref(frame);
+    auto throw_unable_to_decode = [this]() {
+        throw std::runtime_error("Unable to decode '" +
+                                 filename.toStdString() + "'.");
+    };
+    while (true) {
+        int res = avcodec_receive_frame(codec_ctx, frame);
+        if (res == 0) {
+            profile_scope.add_bytes(frame->width * frame->height);
+            return true;
+        }
+        if (res == AVERROR_EOF) {
+            return false;
+        }
+        if (res != AVERROR(EAGAIN)) {
+            throw_unable_to_decode();
+        }
+        if (!is_packet_pending) {
+            if (av_read_frame(format_ctx, packet) < 0) {
+                // flushes the frames buffered by the decoder
+                if (!is_draining) {
+                    res = avcodec_send_packet(codec_ctx, nullptr);
+                    if (res < 0 && res != AVERROR_EOF) {
+                        throw_unable_to_decode();
+                    }
+                    is_draining = true;
+                }
+                continue;
+            }
+            if (packet->stream_index != stream_idx) {
+                av_packet_unref(packet);
+                continue;
+            }
+        }
+        res = avcodec_send_packet(codec_ctx, packet);
+        // the packet is sent again once the decoder has output a frame
+        is_packet_pending = res == AVERROR(EAGAIN);
+        if (is_packet_pending) {
+            continue;
+        }
+        // corrupted packets are skipped as by cv::VideoCapture
+        if (res < 0 && res != AVERROR_INVALIDDATA) {
+            throw_unable_to_decode();
+        }
+        av_packet_unref(packet);
+    }
+}
+
+size_t FfmpegThumbnailsDecoder::get_frame_num() const {
+    const AVStream *stream = format_ctx->streams[stream_idx];
+    int64_t timestamp = frame->best_effort_timestamp;
+    if (timestamp == AV_NOPTS_VALUE) {
+        timestamp = frame->pts;
+    }
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        timestamp -= stream->start_time;
+    }
+    double frame_num = timestamp * av_q2d(stream->time_base) * fps;
+    return frame_num > 0 ? static_cast<size_t>(std::lround(frame_num)) : 0;
+}
+
+void FfmpegThumbnailsDecoder::seek_timestamp(size_t frame_num) {
+    const AVStream *stream = format_ctx->streams[stream_idx];
+    int64_t timestamp = std::llround(frame_num / fps /
+                                     av_q2d(stream->time_base));
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        timestamp += stream->start_time;
+    }
+    if (av_seek_frame(format_ctx, stream_idx, timestamp,
+                      AVSEEK_FLAG_BACKWARD) < 0) {
+        throw std::runtime_error("Unable to seek '" + filename.toStdString() +
+                                 "'.");
+    }
+    avcodec_flush_buffers(codec_ctx);
+    av_frame_unref(frame);
+    av_packet_unref(packet);
+    is_draining = false;
+    is_packet_pending = false;
+}
@@ -0,0 +1,59 @@
+#ifndef FFMPEG_THUMBNAILS_DECODER_HPP
+#define FFMPEG_THUMBNAILS_DECODER_HPP
+
+#include <QString>
+
+#include <opencv2/core.hpp>
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+// Decodes video frames straight into small BGR thumbnails with libavcodec.
+// Frame and slice threading are enabled, the loop filter is skipped and
+// codecs supporting it decode at a reduced resolution, since the thumbnails
+// throw away nearly all of the frame anyway. The thumbnails are therefore
+// close to, but not bitwise the same as, resized cv::VideoCapture frames.
+// Frames are numbered from their timestamps as by cv::VideoCapture, and the
+// numbers are returned along with the thumbnails, so that frames missing or
+// repeated in the stream do not shift the borders.
+class FfmpegThumbnailsDecoder {
+public:
+    FfmpegThumbnailsDecoder(const QString &filename,
+                            const cv::Size &thumbnail_size,
+                            size_t threads_cnt);
+    ~FfmpegThumbnailsDecoder();
+    FfmpegThumbnailsDecoder(const FfmpegThumbnailsDecoder &) = delete;
+    FfmpegThumbnailsDecoder &
+    operator=(const FfmpegThumbnailsDecoder &) = delete;
+    // the next thumbnail read is of this frame
+    void seek(size_t frame_num);
+    // returns false at the end of the video
+    bool read(cv::Mat &thumbnail, size_t &frame_num);
+
+private:
+    bool decode_next_frame();
+    size_t get_frame_num() const;
+    void seek_timestamp(size_t frame_num);
+    void release();
+
+    const QString filename;
+    const cv::Size thumbnail_size;
+    AVFormatContext *format_ctx;
+    AVCodecContext *codec_ctx;
+    AVPacket *packet;
+    AVFrame *frame;
+    SwsContext *sws_ctx;
+    int stream_idx;
+    double fps;
+    // frames before it are decoded but dropped after a seek
+    size_t first_frame_num;
+    bool is_seeking;
+    bool is_draining;
+    // refused by the decoder until a frame is received
+    bool is_packet_pending;
+};
+
+#endif // FFMPEG_THUMBNAILS_DECODER_HPP
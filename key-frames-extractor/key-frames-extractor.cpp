@@ -2,88 +2,287 @@
 
 namespace {
 
-static const size_t hashes_cnt = 4;
+static const size_t hashes_cnt = VideoFingerprint::hashes_cnt;
 
 struct CombinedHash {
-    cv::Mat img;
+    // conversions of the image are shared by all the hashes
+    PreprocessedImage img;
+    cv::Mat resized_frame;
     std::array<cv::Mat, hashes_cnt> hashes;
+    std::array<bool, hashes_cnt> is_computed;
 
-    explicit CombinedHash(const cv::Mat &img);
+    CombinedHash();
+    // keeps the hash buffers to be reused for the new image
+    void reset(const cv::Mat &img);
+    // resizes the frame for hashing into a buffer reused for the next frames
+    void reset_resized(const cv::Mat &frame);
+    void set_hash(size_t i, const cv::Mat &hash);
 };
 
+struct HashHandlerStats {
+    size_t evaluations;
+    // comparisons in which the handler found the frames similar and thus
+    // decided the result of the cascade
+    size_t hits;
+    std::chrono::nanoseconds cost;
+
+    HashHandlerStats();
+    double get_cost_per_hit() const;
+    HashHandlerStats &operator+=(const HashHandlerStats &other);
+    HashHandlerStats &operator-=(const HashHandlerStats &other);
+};
+
+typedef std::array<HashHandlerStats, hashes_cnt> CascadeStats;
+
+// Frames are similar if any of the hashes says so, hence the handlers may be
+// evaluated in any order. Unless a fixed order is given, they are reordered
+// by the measured cost per hit so that the cheapest decisions come first.
 class CombinedHashHandler {
 public:
-    CombinedHashHandler();
+    CombinedHashHandler(const QStringList &cascade_order,
+                        const std::vector<double> &thresholds);
     bool eval_comparison(CombinedHash &a, CombinedHash &b);
+    // computes the hashes missing for a fingerprint
+    void compute_all_hashes(CombinedHash &combined_hash);
+    // computes the hash evaluated first for all the images at once, returns
+    // its index
+    size_t compute_first_hashes(const std::vector<cv::Mat> &imgs,
+                                cv::Mat &hashes);
+    const CascadeStats &get_stats() const;
 
 private:
+    CombinedHashHandler(const QStringList &cascade_order,
+                        const std::array<double, hashes_cnt> &thresholds);
+    void compute_hash(CombinedHash &combined_hash, size_t i);
+    void reorder_by_cost_per_hit();
+
     std::array<std::unique_ptr<HashHandler>, hashes_cnt> handlers;
+    std::array<size_t, hashes_cnt> order;
+    const bool is_adaptive;
+    size_t evaluations_since_reorder;
+    CascadeStats stats;
 };
 
 class PercentPrinter {
 public:
-    PercentPrinter();
+    explicit PercentPrinter(std::ostream &out);
     void print_if_percent_changed(double current, double total,
                                   const std::string &prefix = "",
                                   const std::string &postfix = "");
 
 private:
+    std::ostream &out;
     int displayed_percent;
 };
 
+struct Thumbnail {
+    size_t frame_num;
+    cv::Mat img;
+};
+
+struct KeyFrameCandidate {
+    size_t frame_num;
+    double msec;
+    cv::Mat frame;
+};
+
+// Keeps full resolution frames which may turn out to be the middle frame of
+// the current scene. Once the memory budget is exhausted every other
+// candidate is dropped and the sampling stride doubles, so the chosen key
+// frame is exact for scenes shorter than twice the capacity and the nearest
+// retained frame otherwise.
+class KeyFrameCandidates {
+public:
+    explicit KeyFrameCandidates(size_t memory_budget);
+    void start_scene(size_t first_frame_num);
+    void add_frame(size_t frame_num, double msec, const cv::Mat &frame);
+    const KeyFrameCandidate &get_middle_frame(size_t last_frame_num) const;
+
+private:
+    const size_t memory_budget;
+    size_t capacity;
+    size_t stride;
+    size_t first_frame_num;
+    std::deque<KeyFrameCandidate> candidates;
+};
+
+// Encodes and writes key frames on a pool of threads fed through a bounded
+// queue. Every file name is given by the frame timestamp and the encoder
+// parameters are fixed, so the files are the same as if they were written one
+// by one.
+class KeyFramesWriter {
+public:
+    KeyFramesWriter(const QString &key_frames_directory,
+                    const ExtractionSettings &settings);
+    // lets the writers finish the queued frames
+    ~KeyFramesWriter();
+    // blocks while the queue is full, rethrows an error of the writers
+    void write(const cv::Mat &frame, double msec);
+    // waits until all the frames are written, rethrows an error of the
+    // writers
+    void finish();
+
+private:
+    void write_queued_key_frames();
+
+    const QString key_frames_directory;
+    const QString extension;
+    const std::vector<int> params;
+    BoundedQueue<KeyFrameCandidate> key_frames;
+    std::vector<std::future<void>> writers;
+};
+
 class BorderFramesLocator {
 public:
-    BorderFramesLocator();
+    BorderFramesLocator(const QStringList &cascade_order,
+                        const std::vector<double> &thresholds);
+    // the frame is resized for hashing by the locator
     bool compare_next_frame(const cv::Mat &frame);
+    // same as comparing the frame which the hashes were computed for
+    bool compare_next_fingerprint_frame(const VideoFingerprint &fingerprint,
+                                        size_t frame_num);
+    // same as comparing the frames one by one
+    std::vector<bool> compare_next_frames(const std::vector<cv::Mat> &frames);
+    // computes every hash of the frame without comparing it, the frame is
+    // resized for hashing by the locator
+    void append_fingerprint_frame(const cv::Mat &frame, double msec,
+                                  VideoFingerprint &fingerprint);
+    // forgets the previous frame
+    void reset();
+    // stats since the previous call, the locator keeps learning the cascade
+    // order from all of them
+    CascadeStats take_stats();
 
 private:
+    bool compare_curr_and_prev_frames();
+
     CombinedHashHandler combined_hash_handler;
+    CascadeStats taken_stats;
+    // hashes computed for a frame are reused when it becomes the previous one
+    std::unique_ptr<CombinedHash> curr_hash;
     std::unique_ptr<CombinedHash> prev_hash;
+    bool has_prev_hash;
 };
 
 class KeyFramesExtractor {
 public:
+    explicit KeyFramesExtractor(const ExtractionSettings &settings);
     void locate_key_frames(const QString &input_video_filename);
     void extract_key_frames(const QString &key_frames_directory);
+    void locate_and_extract_key_frames(const QString &input_video_filename,
+                                       const QString &key_frames_directory);
+    const std::vector<size_t> &get_key_frame_nums() const;
+    // of the video located last
+    const CascadeStats &get_cascade_stats() const;
 
 private:
+    struct SegmentBorders {
+        std::vector<size_t> borders;
+        // past the last frame processed, less than the end of the segment if
+        // the video ended earlier
+        size_t end_frame_num;
+        CascadeStats stats;
+        // intervals decoded again from the beginning of the video since
+        // seeking back to them was off
+        size_t reopens_cnt = 0;
+    };
+
+    // the segments are located in parallel and concatenated
+    SegmentBorders
+    locate_borders(const QString &input_video_filename, size_t frames_cnt,
+                   bool use_ffmpeg_decoder,
+                   const std::function<void()> &on_frame_processed);
+    SegmentBorders
+    locate_segment_borders(const QString &input_video_filename,
+                           size_t first_frame_num, size_t end_frame_num,
+                           bool use_ffmpeg_decoder,
+                           const std::function<void()> &on_frame_processed);
+    SegmentBorders locate_segment_borders_coarsely(
+        const QString &input_video_filename, size_t first_frame_num,
+        size_t end_frame_num, const std::function<void()> &on_frame_processed);
+    // loads the sidecar fingerprint or decodes the video to save a new one
+    VideoFingerprint
+    get_fingerprint(const QString &input_video_filename, size_t frames_cnt,
+                    const std::function<void()> &on_frame_processed);
+    VideoFingerprint
+    get_segment_fingerprint(const QString &input_video_filename,
+                            size_t first_frame_num, size_t end_frame_num,
+                            const std::function<void()> &on_frame_processed);
+    SegmentBorders
+    locate_fingerprint_borders(const VideoFingerprint &fingerprint);
+    // locators are returned to the extractor after every segment, so that a
+    // batch worker creates the hash algorithms once for all of its videos
+    std::unique_ptr<BorderFramesLocator> acquire_locator();
+    void release_locator(std::unique_ptr<BorderFramesLocator> bfl);
+
+    const ExtractionSettings settings;
+    // discards everything unless progress is printed
+    std::ostream out;
+    // the video located last, reopened for stage 2 if seeking is off
+    QString input_video_filename;
     cv::VideoCapture cap;
     std::vector<size_t> key_frame_nums;
+    // timestamps of the key frames taken from the fingerprint, empty if the
+    // key frames are named after the decoded positions
+    std::vector<double> key_frame_msecs;
+    CascadeStats cascade_stats;
+    std::mutex locators_mutex;
+    std::vector<std::unique_ptr<BorderFramesLocator>> free_locators;
 };
 
 } // namespace
 
 static const QString timestamp_format = "HH-mm-ss-zzz";
+static const cv::Size thumbnail_size(32, 32);
+static const size_t thumbnails_queue_capacity = 16;
+// thumbnails hashed together by the first hash of the cascade
+static const size_t hashing_batch_size = 8;
+static const std::array<const char *, hashes_cnt> hash_names = {
+    "AverageHash", "PHash", "ColorMomentHash", "RadialVarianceHash"};
+// comparisons between reorderings of an adaptive cascade
+static const size_t cascade_reorder_period = 256;
+// in the order of hash_names
+static const std::array<double, hashes_cnt> default_thresholds = {15, 15, 5.5,
+                                                                  0.708};
+// full resolution frames waiting for every writer thread
+static const size_t key_frames_per_writer = 2;
 
 template <typename T>
-static bool get_thresholding_predicate(double hashes_diff);
-
-template <>
-bool get_thresholding_predicate<cv::img_hash::AverageHash>(double hashes_diff) {
-    return hashes_diff <= 15;
-}
-
-template <>
-bool get_thresholding_predicate<cv::img_hash::PHash>(double hashes_diff) {
-    return hashes_diff <= 15;
+static std::function<bool(double)>
+get_thresholding_predicate(double threshold) {
+    return [threshold](double hashes_diff) {
+        return hashes_diff <= threshold;
+    };
 }
 
 template <>
-bool get_thresholding_predicate<cv::img_hash::ColorMomentHash>(
-    double hashes_diff) {
-    return hashes_diff <= 5.5;
+std::function<bool(double)>
+get_thresholding_predicate<cv::img_hash::RadialVarianceHash>(
+    double threshold) {
+    // yes, >= here
+    return [threshold](double hashes_diff) {
+        return hashes_diff >= threshold;
+    };
 }
 
-template <>
-bool get_thresholding_predicate<cv::img_hash::RadialVarianceHash>(
-    double hashes_diff) {
-    // yes, >= here
-    return hashes_diff >= 0.708;
+template <typename T>
+static std::unique_ptr<HashHandler> get_hash_handler(double threshold) {
+    return std::make_unique<HashHandler>(
+        T::create(), get_thresholding_predicate<T>(threshold));
 }
 
-template <typename T> static std::unique_ptr<HashHandler> get_hash_handler() {
-    return std::make_unique<HashHandler>(T::create(),
-                                         get_thresholding_predicate<T>);
+static std::array<double, hashes_cnt>
+get_thresholds(const std::vector<double> &thresholds) {
+    if (thresholds.empty()) {
+        return default_thresholds;
+    }
+    if (thresholds.size() != hashes_cnt) {
+        throw std::invalid_argument(
+            "Thresholds must be given for every hash.");
+    }
+    std::array<double, hashes_cnt> res;
+    std::copy(thresholds.begin(), thresholds.end(), res.begin());
+    return res;
 }
 
 static void check_file_exists(const QString &path) {
@@ -107,6 +306,56 @@ static void try_create_directory(const QString &path) {
     }
 }
 
+static void resize_for_hashing(const cv::Mat &src, cv::Mat &dst) {
+    ProfileScope profile_scope("resize");
+    cv::resize(src, dst, thumbnail_size);
+}
+
+static bool grab_frame(cv::VideoCapture &vc) {
+    ProfileScope profile_scope("grab");
+    return vc.grab();
+}
+
+static void retrieve_frame(cv::VideoCapture &vc, cv::Mat &frame) {
+    ProfileScope profile_scope("retrieve");
+    vc.retrieve(frame);
+    profile_scope.add_bytes(frame.total() * frame.elemSize());
+}
+
+static std::vector<int> get_image_write_params(const QString &format,
+                                               size_t quality) {
+    if (quality < 1 || quality > 100) {
+        throw std::invalid_argument("Quality must be from 1 to 100.");
+    }
+    if (format == "jpg") {
+        return {cv::IMWRITE_JPEG_QUALITY, static_cast<int>(quality)};
+    }
+    if (format == "png") {
+        return {};
+    }
+    if (format == "webp") {
+        return {cv::IMWRITE_WEBP_QUALITY, static_cast<int>(quality)};
+    }
+    throw std::invalid_argument("Unsupported output format '" +
+                                format.toStdString() + "'.");
+}
+
+static void write_key_frame(const QString &key_frames_directory,
+                            const QString &extension,
+                            const std::vector<int> &params,
+                            const cv::Mat &frame, double msec) {
+    QString key_frame_filename =
+        key_frames_directory + "/" +
+        QTime::fromMSecsSinceStartOfDay(msec).toString(timestamp_format) +
+        "." + extension;
+    ProfileScope profile_scope("imwrite");
+    if (!cv::imwrite(key_frame_filename.toStdString(), frame, params)) {
+        throw std::runtime_error("Unable to write key frame to '" +
+                                 key_frame_filename.toStdString() + "'.");
+    }
+    profile_scope.add_bytes(QFileInfo(key_frame_filename).size());
+}
+
 static void try_open_video(cv::VideoCapture &vc, const QString &path) {
     if (!vc.open(path.toStdString())) {
         throw std::runtime_error(
@@ -115,89 +364,545 @@ static void try_open_video(cv::VideoCapture &vc, const QString &path) {
     }
 }
 
-CombinedHash::CombinedHash(const cv::Mat &img) : img(img) {}
+// CAP_PROP_POS_FRAMES seeks are frame-accurate only for some containers, so
+// the position is read back, returns false if it is off
+static bool try_seek_frame(cv::VideoCapture &vc, size_t frame_num) {
+    ProfileScope profile_scope("seek");
+    return vc.set(cv::CAP_PROP_POS_FRAMES, frame_num) &&
+           std::llround(vc.get(cv::CAP_PROP_POS_FRAMES)) ==
+               static_cast<long long>(frame_num);
+}
+
+static void skip_frames(cv::VideoCapture &vc, const QString &path,
+                        size_t first_frame_num, size_t end_frame_num) {
+    ProfileScope profile_scope("skip", end_frame_num - first_frame_num);
+    for (size_t i = first_frame_num; i < end_frame_num; ++i) {
+        if (!vc.grab()) {
+            throw std::runtime_error("Error: unable to decode frame " +
+                                     std::to_string(i) + " of '" +
+                                     path.toStdString() + "'.");
+        }
+    }
+}
+
+// falls back to decoding the video from the beginning up to the frame if
+// the seek is off
+static void seek_frame(cv::VideoCapture &vc, const QString &path,
+                       size_t frame_num) {
+    if (!try_seek_frame(vc, frame_num)) {
+        try_open_video(vc, path);
+        skip_frames(vc, path, 0, frame_num);
+    }
+}
 
-CombinedHashHandler::CombinedHashHandler()
-    : handlers{get_hash_handler<cv::img_hash::AverageHash>(),
-               get_hash_handler<cv::img_hash::PHash>(),
-               get_hash_handler<cv::img_hash::ColorMomentHash>(),
-               get_hash_handler<cv::img_hash::RadialVarianceHash>()} {}
+static void check_ffmpeg_decoder_is_built(bool use_ffmpeg_decoder) {
+#ifndef IMG_HASH_TOOLS_FFMPEG_DECODER
+    if (use_ffmpeg_decoder) {
+        throw std::invalid_argument("Built without the FFmpeg decoder.");
+    }
+#else
+    (void)use_ffmpeg_decoder;
+#endif
+}
+
+// returns a reader of the thumbnails and numbers of the frames from
+// first_frame_num on, which is false at the end of the video
+static std::function<bool(cv::Mat &, size_t &)>
+get_thumbnails_reader(const QString &input_video_filename,
+                      size_t first_frame_num, bool use_ffmpeg_decoder,
+                      const ExtractionSettings &settings) {
+#ifdef IMG_HASH_TOOLS_FFMPEG_DECODER
+    if (use_ffmpeg_decoder) {
+        // the cores left by the parallel segments decode every segment
+        size_t decoder_threads_cnt = std::max<size_t>(
+            1, std::thread::hardware_concurrency() /
+                   std::max<size_t>(1, settings.threads_cnt));
+        auto decoder = std::make_shared<FfmpegThumbnailsDecoder>(
+            input_video_filename, thumbnail_size, decoder_threads_cnt);
+        if (first_frame_num > 0) {
+            decoder->seek(first_frame_num);
+        }
+        return [decoder](cv::Mat &thumbnail, size_t &frame_num) {
+            return decoder->read(thumbnail, frame_num);
+        };
+    }
+#endif
+    check_ffmpeg_decoder_is_built(use_ffmpeg_decoder);
+    auto vc = std::make_shared<cv::VideoCapture>();
+    try_open_video(*vc, input_video_filename);
+    if (first_frame_num > 0) {
+        seek_frame(*vc, input_video_filename, first_frame_num);
+    }
+    // the seek is checked, so the frames are counted from it
+    auto next_frame_num = std::make_shared<size_t>(first_frame_num);
+    auto frame = std::make_shared<cv::Mat>();
+    return [vc, next_frame_num, frame](cv::Mat &thumbnail, size_t &frame_num) {
+        if (!grab_frame(*vc)) {
+            return false;
+        }
+        retrieve_frame(*vc, *frame);
+        resize_for_hashing(*frame, thumbnail);
+        frame_num = (*next_frame_num)++;
+        return true;
+    };
+}
+
+static std::array<size_t, hashes_cnt>
+get_cascade_order(const QStringList &cascade_order) {
+    std::array<size_t, hashes_cnt> order;
+    if (cascade_order.isEmpty()) {
+        std::iota(order.begin(), order.end(), 0);
+        return order;
+    }
+    if (static_cast<size_t>(cascade_order.size()) != hashes_cnt) {
+        throw std::invalid_argument(
+            "Cascade order must list every hash exactly once.");
+    }
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        auto it = std::find(hash_names.begin(), hash_names.end(),
+                            cascade_order.at(i).trimmed().toStdString());
+        size_t handler_idx = it - hash_names.begin();
+        if (it == hash_names.end() ||
+            std::find(order.begin(), order.begin() + i, handler_idx) !=
+                order.begin() + i) {
+            throw std::invalid_argument(
+                "Cascade order must list every hash exactly once.");
+        }
+        order.at(i) = handler_idx;
+    }
+    return order;
+}
+
+static void print_cascade_stats(std::ostream &out, const CascadeStats &stats) {
+    out << "Cascade stats (evaluations, hits, cost per hit):\n";
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        out << "  " << hash_names.at(i) << ": " << stats.at(i).evaluations
+            << ", " << stats.at(i).hits << ", ";
+        if (stats.at(i).hits == 0) {
+            out << "-";
+        } else {
+            out << stats.at(i).get_cost_per_hit() / 1000 << " us";
+        }
+        out << "\n";
+    }
+}
+
+// borders of the two decoders are matched in order, a border within a frame
+// of the other decoder's one counts as off by one
+static void print_decoders_diff(std::ostream &out,
+                                const std::vector<size_t> &ffmpeg_borders,
+                                const std::vector<size_t> &opencv_borders) {
+    size_t same_cnt = 0;
+    size_t off_by_one_cnt = 0;
+    std::vector<size_t> ffmpeg_only_borders;
+    std::vector<size_t> opencv_only_borders;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < ffmpeg_borders.size() || j < opencv_borders.size()) {
+        if (i == ffmpeg_borders.size()) {
+            opencv_only_borders.push_back(opencv_borders.at(j++));
+        } else if (j == opencv_borders.size()) {
+            ffmpeg_only_borders.push_back(ffmpeg_borders.at(i++));
+        } else if (ffmpeg_borders.at(i) == opencv_borders.at(j)) {
+            ++same_cnt;
+            ++i;
+            ++j;
+        } else if (ffmpeg_borders.at(i) + 1 == opencv_borders.at(j) ||
+                   opencv_borders.at(j) + 1 == ffmpeg_borders.at(i)) {
+            ++off_by_one_cnt;
+            ++i;
+            ++j;
+        } else if (ffmpeg_borders.at(i) < opencv_borders.at(j)) {
+            ffmpeg_only_borders.push_back(ffmpeg_borders.at(i++));
+        } else {
+            opencv_only_borders.push_back(opencv_borders.at(j++));
+        }
+    }
+    auto print_frame_nums = [&out](const std::vector<size_t> &frame_nums) {
+        for (size_t frame_num : frame_nums) {
+            out << " " << frame_num;
+        }
+        out << "\n";
+    };
+    out << "\nFFmpeg decoder borders against OpenCV ones: " << same_cnt
+        << " same, " << off_by_one_cnt << " off by one frame, "
+        << ffmpeg_only_borders.size() << " only FFmpeg, "
+        << opencv_only_borders.size() << " only OpenCV.\n";
+    if (!ffmpeg_only_borders.empty()) {
+        out << "  only FFmpeg:";
+        print_frame_nums(ffmpeg_only_borders);
+    }
+    if (!opencv_only_borders.empty()) {
+        out << "  only OpenCV:";
+        print_frame_nums(opencv_only_borders);
+    }
+}
+
+CombinedHash::CombinedHash() { is_computed.fill(false); }
+
+void CombinedHash::reset(const cv::Mat &img) {
+    this->img.reset(img);
+    is_computed.fill(false);
+}
+
+void CombinedHash::reset_resized(const cv::Mat &frame) {
+    // the previous frame has been released by now, so the buffer is free
+    resize_for_hashing(frame, resized_frame);
+    reset(resized_frame);
+}
+
+void CombinedHash::set_hash(size_t i, const cv::Mat &hash) {
+    // copied so that the hash never aliases a batch buffer
+    hash.copyTo(hashes.at(i));
+    is_computed.at(i) = true;
+}
+
+HashHandlerStats::HashHandlerStats() : evaluations(0), hits(0), cost(0) {}
+
+double HashHandlerStats::get_cost_per_hit() const {
+    return hits == 0 ? std::numeric_limits<double>::infinity()
+                     : static_cast<double>(cost.count()) / hits;
+}
+
+HashHandlerStats &HashHandlerStats::operator+=(const HashHandlerStats &other) {
+    evaluations += other.evaluations;
+    hits += other.hits;
+    cost += other.cost;
+    return *this;
+}
+
+HashHandlerStats &HashHandlerStats::operator-=(const HashHandlerStats &other) {
+    evaluations -= other.evaluations;
+    hits -= other.hits;
+    cost -= other.cost;
+    return *this;
+}
+
+CombinedHashHandler::CombinedHashHandler(
+    const QStringList &cascade_order, const std::vector<double> &thresholds)
+    : CombinedHashHandler(cascade_order, get_thresholds(thresholds)) {}
+
+CombinedHashHandler::CombinedHashHandler(
+    const QStringList &cascade_order,
+    const std::array<double, hashes_cnt> &thresholds)
+    : handlers{get_hash_handler<cv::img_hash::AverageHash>(thresholds.at(0)),
+               get_hash_handler<cv::img_hash::PHash>(thresholds.at(1)),
+               get_hash_handler<cv::img_hash::ColorMomentHash>(
+                   thresholds.at(2)),
+               get_hash_handler<cv::img_hash::RadialVarianceHash>(
+                   thresholds.at(3))},
+      order(get_cascade_order(cascade_order)),
+      is_adaptive(cascade_order.isEmpty()), evaluations_since_reorder(0) {}
 
 bool CombinedHashHandler::eval_comparison(CombinedHash &a, CombinedHash &b) {
     std::array<CombinedHash *, 2> a_and_b = {&a, &b};
-    for (auto combined_hash : a_and_b) {
-        if (combined_hash->img.empty()) {
-            throw std::logic_error(
-                "Evaluating comparison is forbidden: empty image.");
-        }
+    if (is_adaptive && ++evaluations_since_reorder == cascade_reorder_period) {
+        reorder_by_cost_per_hit();
+        evaluations_since_reorder = 0;
     }
-    for (size_t i = 0; i < handlers.size(); ++i) {
+    for (size_t i : order) {
+        HashHandlerStats &handler_stats = stats.at(i);
+        auto start_time = std::chrono::steady_clock::now();
         for (auto combined_hash : a_and_b) {
-            if (combined_hash->hashes.at(i).empty()) {
-                combined_hash->hashes.at(i) =
-                    handlers.at(i)->compute(combined_hash->img);
-            }
+            compute_hash(*combined_hash, i);
         }
-        if (handlers.at(i)->compare(a.hashes.at(i), b.hashes.at(i))) {
+        bool is_hit = handlers.at(i)->compare(a.hashes.at(i), b.hashes.at(i));
+        handler_stats.cost += std::chrono::steady_clock::now() - start_time;
+        ++handler_stats.evaluations;
+        if (is_hit) {
+            ++handler_stats.hits;
             return true;
         }
     }
     return false;
 }
 
-PercentPrinter::PercentPrinter() : displayed_percent(-1) {}
+size_t CombinedHashHandler::compute_first_hashes(
+    const std::vector<cv::Mat> &imgs, cv::Mat &hashes) {
+    size_t i = order.front();
+    auto start_time = std::chrono::steady_clock::now();
+    handlers.at(i)->compute_batch(imgs.data(), imgs.size(), hashes);
+    stats.at(i).cost += std::chrono::steady_clock::now() - start_time;
+    return i;
+}
+
+void CombinedHashHandler::compute_all_hashes(CombinedHash &combined_hash) {
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        compute_hash(combined_hash, i);
+    }
+}
+
+const CascadeStats &CombinedHashHandler::get_stats() const { return stats; }
+
+void CombinedHashHandler::compute_hash(CombinedHash &combined_hash, size_t i) {
+    if (combined_hash.is_computed.at(i)) {
+        return;
+    }
+    // hashes of fingerprint frames come without the image
+    if (combined_hash.img.empty()) {
+        throw std::logic_error("Computing hash is forbidden: empty image.");
+    }
+    handlers.at(i)->compute(combined_hash.img, combined_hash.hashes.at(i));
+    combined_hash.is_computed.at(i) = true;
+}
+
+void CombinedHashHandler::reorder_by_cost_per_hit() {
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return stats.at(a).get_cost_per_hit() < stats.at(b).get_cost_per_hit();
+    });
+}
+
+PercentPrinter::PercentPrinter(std::ostream &out)
+    : out(out), displayed_percent(-1) {}
 
 void PercentPrinter::print_if_percent_changed(double current, double total,
                                               const std::string &prefix,
                                               const std::string &postfix) {
     int actual_percent = current / total * 100;
     if (actual_percent != displayed_percent) {
-        std::cout << prefix << actual_percent << postfix << std::flush;
+        out << prefix << actual_percent << postfix << std::flush;
         displayed_percent = actual_percent;
     }
 }
 
-BorderFramesLocator::BorderFramesLocator() : prev_hash(nullptr) {}
+KeyFrameCandidates::KeyFrameCandidates(size_t memory_budget)
+    : memory_budget(memory_budget), capacity(0), stride(1),
+      first_frame_num(0) {}
+
+void KeyFrameCandidates::start_scene(size_t first_frame_num) {
+    this->first_frame_num = first_frame_num;
+    stride = 1;
+    candidates.clear();
+}
+
+void KeyFrameCandidates::add_frame(size_t frame_num, double msec,
+                                   const cv::Mat &frame) {
+    if (capacity == 0) {
+        capacity = std::max<size_t>(
+            2, memory_budget / (frame.total() * frame.elemSize()));
+    }
+    // the middle frame of a scene ending at frame_num or later is not before
+    // this one, while the preceding candidate is kept as the nearest one
+    size_t middle_frame_num =
+        first_frame_num + (frame_num - first_frame_num) / 2;
+    while (candidates.size() > 1 &&
+           candidates.at(1).frame_num <= middle_frame_num) {
+        candidates.pop_front();
+    }
+    if (!candidates.empty() &&
+        frame_num - candidates.back().frame_num < stride) {
+        return;
+    }
+    candidates.push_back(KeyFrameCandidate{frame_num, msec, frame.clone()});
+    if (candidates.size() > capacity) {
+        for (size_t i = 1; i < candidates.size(); ++i) {
+            candidates.erase(candidates.begin() + i);
+        }
+        stride *= 2;
+    }
+}
+
+const KeyFrameCandidate &
+KeyFrameCandidates::get_middle_frame(size_t last_frame_num) const {
+    if (candidates.empty()) {
+        throw std::logic_error("Error: no key frame candidates.");
+    }
+    // b + (a - b) / 2, a >= b (crucial for unsigned)
+    size_t middle_frame_num =
+        first_frame_num + (last_frame_num - first_frame_num) / 2;
+    auto get_offset = [middle_frame_num](const KeyFrameCandidate &candidate) {
+        return candidate.frame_num > middle_frame_num
+                   ? candidate.frame_num - middle_frame_num
+                   : middle_frame_num - candidate.frame_num;
+    };
+    return *std::min_element(
+        candidates.begin(), candidates.end(),
+        [&get_offset](const KeyFrameCandidate &a, const KeyFrameCandidate &b) {
+            return get_offset(a) < get_offset(b);
+        });
+}
+
+KeyFramesWriter::KeyFramesWriter(const QString &key_frames_directory,
+                                 const ExtractionSettings &settings)
+    : key_frames_directory(key_frames_directory),
+      extension(settings.output_format),
+      params(get_image_write_params(settings.output_format,
+                                    settings.output_quality)),
+      key_frames(std::max<size_t>(1, settings.writer_threads_cnt) *
+                 key_frames_per_writer) {
+    for (size_t i = 0; i < std::max<size_t>(1, settings.writer_threads_cnt);
+         ++i) {
+        writers.push_back(std::async(
+            std::launch::async, &KeyFramesWriter::write_queued_key_frames,
+            this));
+    }
+}
+
+KeyFramesWriter::~KeyFramesWriter() {
+    key_frames.close();
+    for (auto &writer : writers) {
+        if (writer.valid()) {
+            writer.wait();
+        }
+    }
+}
+
+void KeyFramesWriter::write(const cv::Mat &frame, double msec) {
+    if (!key_frames.push(KeyFrameCandidate{0, msec, frame})) {
+        finish();
+        throw std::logic_error("Error: key frames writers are stopped.");
+    }
+}
+
+void KeyFramesWriter::finish() {
+    key_frames.close();
+    for (auto &writer : writers) {
+        if (writer.valid()) {
+            writer.get();
+        }
+    }
+}
+
+void KeyFramesWriter::write_queued_key_frames() {
+    try {
+        KeyFrameCandidate key_frame{0, 0, cv::Mat()};
+        while (key_frames.pop(key_frame)) {
+            write_key_frame(key_frames_directory, extension, params,
+                            key_frame.frame, key_frame.msec);
+            // the frame buffer is released before waiting for the next one
+            key_frame.frame.release();
+        }
+    } catch (...) {
+        // the extractor learns about the error on its next write
+        key_frames.close();
+        throw;
+    }
+}
+
+BorderFramesLocator::BorderFramesLocator(const QStringList &cascade_order,
+                                         const std::vector<double> &thresholds)
+    : combined_hash_handler(cascade_order, thresholds),
+      curr_hash(std::make_unique<CombinedHash>()),
+      prev_hash(std::make_unique<CombinedHash>()), has_prev_hash(false) {}
 
 bool BorderFramesLocator::compare_next_frame(const cv::Mat &frame) {
-    std::unique_ptr<CombinedHash> curr_hash =
-        std::make_unique<CombinedHash>(frame);
-    bool res = (prev_hash != nullptr) &&
+    curr_hash->reset_resized(frame);
+    return compare_curr_and_prev_frames();
+}
+
+bool BorderFramesLocator::compare_next_fingerprint_frame(
+    const VideoFingerprint &fingerprint, size_t frame_num) {
+    curr_hash->reset(cv::Mat());
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        curr_hash->set_hash(i, fingerprint.get_hash(i, frame_num));
+    }
+    return compare_curr_and_prev_frames();
+}
+
+std::vector<bool>
+BorderFramesLocator::compare_next_frames(const std::vector<cv::Mat> &frames) {
+    // every frame is evaluated by the first hash of the cascade at least
+    // once, so computing it for the whole batch never wastes work
+    cv::Mat first_hashes;
+    size_t first_hash_idx =
+        combined_hash_handler.compute_first_hashes(frames, first_hashes);
+    std::vector<bool> res;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        curr_hash->reset(frames.at(i));
+        curr_hash->set_hash(first_hash_idx, first_hashes.row(i));
+        res.push_back(compare_curr_and_prev_frames());
+    }
+    return res;
+}
+
+void BorderFramesLocator::append_fingerprint_frame(
+    const cv::Mat &frame, double msec, VideoFingerprint &fingerprint) {
+    curr_hash->reset_resized(frame);
+    combined_hash_handler.compute_all_hashes(*curr_hash);
+    fingerprint.append(msec, curr_hash->hashes);
+    curr_hash->img.release();
+}
+
+bool BorderFramesLocator::compare_curr_and_prev_frames() {
+    bool res = has_prev_hash &&
                !combined_hash_handler.eval_comparison(*curr_hash, *prev_hash);
-    prev_hash = std::move(curr_hash);
+    std::swap(curr_hash, prev_hash);
+    has_prev_hash = true;
+    // the frame preceding the current one is not needed anymore
+    curr_hash->img.release();
     return res;
 }
 
+void BorderFramesLocator::reset() {
+    has_prev_hash = false;
+    prev_hash->img.release();
+}
+
+CascadeStats BorderFramesLocator::take_stats() {
+    CascadeStats res = combined_hash_handler.get_stats();
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        res.at(i) -= taken_stats.at(i);
+    }
+    taken_stats = combined_hash_handler.get_stats();
+    return res;
+}
+
+KeyFramesExtractor::KeyFramesExtractor(const ExtractionSettings &settings)
+    : settings(settings),
+      out(settings.print_progress ? std::cout.rdbuf() : nullptr) {}
+
 void KeyFramesExtractor::locate_key_frames(
     const QString &input_video_filename) {
+    ProfileScope profile_scope("locate key frames");
     key_frame_nums.clear();
+    key_frame_msecs.clear();
+    this->input_video_filename = input_video_filename;
     try_open_video(cap, input_video_filename);
     size_t frames_cnt = cap.get(cv::CAP_PROP_FRAME_COUNT);
     if (frames_cnt == 0) {
         throw std::runtime_error("Found no frames to process.");
     }
-    std::cout << "Found " << frames_cnt << " frames to process.\n";
-    PercentPrinter printer;
-    BorderFramesLocator bfl;
-    std::vector<size_t> borders = {0};
-    auto prepare_for_hashing = [](const cv::Mat &src) -> cv::Mat {
-        cv::Mat res;
-        cv::resize(src, res, cv::Size(32, 32));
-        return res;
+    profile_scope.set_items(frames_cnt);
+    out << "Found " << frames_cnt << " frames to process.\n";
+    PercentPrinter printer(out);
+    std::mutex printer_mutex;
+    size_t frames_processed = 0;
+    auto on_frame_processed = [&]() {
+        std::lock_guard<std::mutex> lock(printer_mutex);
+        printer.print_if_percent_changed(
+            ++frames_processed, frames_cnt,
+            "\rLocating key frames (stage 1 of 2)... ", "%");
     };
-    for (size_t i = 0; i < frames_cnt; ++i) {
-        if (!cap.grab()) {
-            std::cout << "\nExtra break after frame " + std::to_string(i) +
-                             ". End of video?";
-            break;
-        }
-        cv::Mat frame;
-        cap.retrieve(frame);
-        if (bfl.compare_next_frame(prepare_for_hashing(frame))) {
-            borders.push_back(i);
+    std::vector<size_t> borders = {0};
+    CascadeStats stats;
+    VideoFingerprint fingerprint;
+    if (settings.use_fingerprint) {
+        fingerprint = get_fingerprint(input_video_filename, frames_cnt,
+                                      on_frame_processed);
+        SegmentBorders fingerprint_borders =
+            locate_fingerprint_borders(fingerprint);
+        borders.insert(borders.end(), fingerprint_borders.borders.begin(),
+                       fingerprint_borders.borders.end());
+        stats = fingerprint_borders.stats;
+    } else {
+        SegmentBorders located_borders =
+            locate_borders(input_video_filename, frames_cnt,
+                           settings.use_ffmpeg_decoder, on_frame_processed);
+        borders.insert(borders.end(), located_borders.borders.begin(),
+                       located_borders.borders.end());
+        stats = located_borders.stats;
+        if (settings.validate_ffmpeg_decoder) {
+            size_t frames_validated = 0;
+            SegmentBorders opencv_borders = locate_borders(
+                input_video_filename, frames_cnt, false, [&]() {
+                    std::lock_guard<std::mutex> lock(printer_mutex);
+                    printer.print_if_percent_changed(
+                        ++frames_validated, frames_cnt,
+                        "\rValidating FFmpeg decoder... ", "%");
+                });
+            print_decoders_diff(out, located_borders.borders,
+                                opencv_borders.borders);
         }
-        printer.print_if_percent_changed(
-            i + 1, frames_cnt, "\rLocating key frames (stage 1 of 2)... ", "%");
     }
     borders.push_back(frames_cnt - 1);
     for (size_t i = 1; i < borders.size(); ++i) {
@@ -206,50 +911,602 @@ void KeyFramesExtractor::locate_key_frames(
         key_frame_nums.push_back(borders.at(i - 1) +
                                  (borders.at(i) - borders.at(i - 1)) / 2);
     }
-    std::cout << "\nLocated " << key_frame_nums.size() << " key frames.\n";
+    // unless the video ended before the reported frames count, the key
+    // frames are named after the timestamps of the fingerprint
+    for (size_t key_frame_num : key_frame_nums) {
+        if (key_frame_num >= fingerprint.get_frames_cnt()) {
+            key_frame_msecs.clear();
+            break;
+        }
+        key_frame_msecs.push_back(fingerprint.get_msec(key_frame_num));
+    }
+    out << "\nLocated " << key_frame_nums.size() << " key frames.\n";
+    cascade_stats = stats;
+    if (settings.print_cascade_stats) {
+        print_cascade_stats(out, cascade_stats);
+    }
+}
+
+KeyFramesExtractor::SegmentBorders KeyFramesExtractor::locate_borders(
+    const QString &input_video_filename, size_t frames_cnt,
+    bool use_ffmpeg_decoder, const std::function<void()> &on_frame_processed) {
+    // every segment is decoded by its own thread, segment borders are
+    // concatenated afterwards in the order of segments
+    size_t segments_cnt =
+        std::max<size_t>(1, std::min(settings.threads_cnt, frames_cnt));
+    std::vector<std::future<SegmentBorders>> segments;
+    for (size_t i = 0; i < segments_cnt; ++i) {
+        segments.push_back(std::async(
+            std::launch::async, &KeyFramesExtractor::locate_segment_borders,
+            this, input_video_filename, frames_cnt * i / segments_cnt,
+            frames_cnt * (i + 1) / segments_cnt, use_ffmpeg_decoder,
+            on_frame_processed));
+    }
+    SegmentBorders located_borders{{}, frames_cnt, CascadeStats()};
+    for (size_t i = 0; i < segments_cnt; ++i) {
+        SegmentBorders segment = segments.at(i).get();
+        size_t end_frame_num = frames_cnt * (i + 1) / segments_cnt;
+        if (located_borders.end_frame_num == frames_cnt &&
+            segment.end_frame_num < end_frame_num) {
+            out << "\nExtra break after frame " << segment.end_frame_num
+                << ". End of video?";
+            located_borders.end_frame_num = segment.end_frame_num;
+        }
+        located_borders.borders.insert(located_borders.borders.end(),
+                                       segment.borders.begin(),
+                                       segment.borders.end());
+        for (size_t j = 0; j < hashes_cnt; ++j) {
+            located_borders.stats.at(j) += segment.stats.at(j);
+        }
+        located_borders.reopens_cnt += segment.reopens_cnt;
+    }
+    if (located_borders.reopens_cnt > 0) {
+        out << "\nSeeking is off, " << located_borders.reopens_cnt
+            << " sampled intervals were decoded again from the beginning.";
+    }
+    return located_borders;
+}
+
+KeyFramesExtractor::SegmentBorders KeyFramesExtractor::locate_segment_borders(
+    const QString &input_video_filename, size_t first_frame_num,
+    size_t end_frame_num, bool use_ffmpeg_decoder,
+    const std::function<void()> &on_frame_processed) {
+    if (settings.sampling_step > 1) {
+        return locate_segment_borders_coarsely(input_video_filename,
+                                               first_frame_num, end_frame_num,
+                                               on_frame_processed);
+    }
+    // the frame preceding the segment is decoded as well so that the first
+    // frame of the segment is compared exactly as in a sequential pass
+    size_t start_frame_num = first_frame_num > 0 ? first_frame_num - 1 : 0;
+    std::function<bool(cv::Mat &, size_t &)> read_thumbnail =
+        get_thumbnails_reader(input_video_filename, start_frame_num,
+                              use_ffmpeg_decoder, settings);
+    // decoding and downsampling run on a producer thread while hashing runs
+    // on this one, the thumbnail buffers circulate between them via a pool
+    BoundedQueue<Thumbnail> thumbnails(thumbnails_queue_capacity);
+    // the consumer holds a batch being collected and the last thumbnail of
+    // the previous one, the producer fills one more
+    size_t imgs_pool_size = thumbnails_queue_capacity + hashing_batch_size + 2;
+    BoundedQueue<cv::Mat> free_imgs(imgs_pool_size);
+    for (size_t i = 0; i < imgs_pool_size; ++i) {
+        free_imgs.push(cv::Mat(thumbnail_size, CV_8UC3));
+    }
+    auto close_queues = [&]() {
+        thumbnails.close();
+        free_imgs.close();
+    };
+    std::future<void> producer = std::async(std::launch::async, [&]() {
+        try {
+            // frames are numbered by the reader, which for the FFmpeg decoder
+            // follows the timestamps rather than counts the frames
+            while (true) {
+                Thumbnail thumbnail{0, cv::Mat()};
+                if (!free_imgs.pop(thumbnail.img) ||
+                    !read_thumbnail(thumbnail.img, thumbnail.frame_num) ||
+                    thumbnail.frame_num >= end_frame_num) {
+                    break;
+                }
+                if (!thumbnails.push(std::move(thumbnail))) {
+                    break;
+                }
+            }
+        } catch (...) {
+            close_queues();
+            throw;
+        }
+        thumbnails.close();
+    });
+    std::unique_ptr<BorderFramesLocator> bfl = acquire_locator();
+    SegmentBorders segment{{}, first_frame_num, CascadeStats()};
+    try {
+        std::vector<Thumbnail> batch;
+        std::vector<cv::Mat> batch_imgs;
+        cv::Mat prev_img;
+        bool is_drained = false;
+        while (!is_drained) {
+            Thumbnail thumbnail{0, cv::Mat()};
+            while (batch.size() < hashing_batch_size) {
+                if (!thumbnails.pop(thumbnail)) {
+                    is_drained = true;
+                    break;
+                }
+                batch_imgs.push_back(thumbnail.img);
+                batch.push_back(std::move(thumbnail));
+            }
+            std::vector<bool> is_border = bfl->compare_next_frames(batch_imgs);
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (is_border.at(i)) {
+                    segment.borders.push_back(batch.at(i).frame_num);
+                }
+                if (batch.at(i).frame_num >= first_frame_num) {
+                    segment.end_frame_num = batch.at(i).frame_num + 1;
+                    on_frame_processed();
+                }
+            }
+            // the locator keeps only the last thumbnail of the batch
+            batch_imgs.clear();
+            for (auto &batch_thumbnail : batch) {
+                if (!prev_img.empty()) {
+                    free_imgs.push(std::move(prev_img));
+                }
+                prev_img = std::move(batch_thumbnail.img);
+            }
+            batch.clear();
+        }
+    } catch (...) {
+        close_queues();
+        throw;
+    }
+    producer.get();
+    segment.stats = bfl->take_stats();
+    release_locator(std::move(bfl));
+    return segment;
+}
+
+KeyFramesExtractor::SegmentBorders
+KeyFramesExtractor::locate_segment_borders_coarsely(
+    const QString &input_video_filename, size_t first_frame_num,
+    size_t end_frame_num, const std::function<void()> &on_frame_processed) {
+    cv::VideoCapture segment_cap;
+    try_open_video(segment_cap, input_video_filename);
+    size_t start_frame_num = first_frame_num > 0 ? first_frame_num - 1 : 0;
+    if (start_frame_num > 0) {
+        seek_frame(segment_cap, input_video_filename, start_frame_num);
+    }
+    SegmentBorders segment{{}, first_frame_num, CascadeStats()};
+    auto on_frame_grabbed = [&](size_t frame_num) {
+        if (frame_num >= first_frame_num) {
+            segment.end_frame_num = frame_num + 1;
+            on_frame_processed();
+        }
+    };
+    // every sampling_step-th frame is compared with the previous sample, the
+    // frames in between are only grabbed unless the samples differ, then the
+    // interval is decoded again and every frame of it is compared
+    std::unique_ptr<BorderFramesLocator> coarse_bfl = acquire_locator();
+    std::unique_ptr<BorderFramesLocator> dense_bfl = acquire_locator();
+    // once a seek back is off, the video is reopened and decoded up to every
+    // later interval instead, which keeps the sampling but is reported
+    bool is_seeking_exact = true;
+    auto refine_interval = [&](size_t sample_frame_num, size_t frame_num) {
+        // adjacent samples differ exactly at the later one
+        if (frame_num == sample_frame_num + 1) {
+            segment.borders.push_back(frame_num);
+            return;
+        }
+        if (!is_seeking_exact ||
+            !try_seek_frame(segment_cap, sample_frame_num)) {
+            is_seeking_exact = false;
+            ++segment.reopens_cnt;
+            try_open_video(segment_cap, input_video_filename);
+            skip_frames(segment_cap, input_video_filename, 0,
+                        sample_frame_num);
+        }
+        dense_bfl->reset();
+        cv::Mat frame;
+        for (size_t i = sample_frame_num; i <= frame_num; ++i) {
+            if (!grab_frame(segment_cap)) {
+                throw std::runtime_error(
+                    "Error: unable to decode frame " + std::to_string(i) +
+                    " again. Video is not seekable?");
+            }
+            retrieve_frame(segment_cap, frame);
+            if (dense_bfl->compare_next_frame(frame)) {
+                segment.borders.push_back(i);
+            }
+        }
+    };
+    cv::Mat frame;
+    size_t sample_frame_num = start_frame_num;
+    for (size_t i = start_frame_num; i < end_frame_num;) {
+        if (!grab_frame(segment_cap)) {
+            break;
+        }
+        on_frame_grabbed(i);
+        retrieve_frame(segment_cap, frame);
+        if (coarse_bfl->compare_next_frame(frame)) {
+            refine_interval(sample_frame_num, i);
+        }
+        sample_frame_num = i;
+        if (i + 1 == end_frame_num) {
+            break;
+        }
+        // the last frame of the segment is always sampled
+        size_t next_sample_frame_num =
+            std::min(i + settings.sampling_step, end_frame_num - 1);
+        for (++i; i < next_sample_frame_num && grab_frame(segment_cap); ++i) {
+            on_frame_grabbed(i);
+        }
+        if (i < next_sample_frame_num) {
+            break;
+        }
+    }
+    segment.stats = coarse_bfl->take_stats();
+    CascadeStats dense_stats = dense_bfl->take_stats();
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        segment.stats.at(i) += dense_stats.at(i);
+    }
+    release_locator(std::move(coarse_bfl));
+    release_locator(std::move(dense_bfl));
+    return segment;
+}
+
+VideoFingerprint KeyFramesExtractor::get_fingerprint(
+    const QString &input_video_filename, size_t frames_cnt,
+    const std::function<void()> &on_frame_processed) {
+    VideoFingerprint fingerprint;
+    if (fingerprint.load(input_video_filename)) {
+        out << "Loaded fingerprint of " << fingerprint.get_frames_cnt()
+            << " frames.";
+        return fingerprint;
+    }
+    // segments are fingerprinted in parallel and concatenated up to the
+    // first one ended early, so that frame numbers stay contiguous
+    size_t segments_cnt =
+        std::max<size_t>(1, std::min(settings.threads_cnt, frames_cnt));
+    std::vector<std::future<VideoFingerprint>> segments;
+    for (size_t i = 0; i < segments_cnt; ++i) {
+        segments.push_back(std::async(
+            std::launch::async, &KeyFramesExtractor::get_segment_fingerprint,
+            this, input_video_filename, frames_cnt * i / segments_cnt,
+            frames_cnt * (i + 1) / segments_cnt, on_frame_processed));
+    }
+    bool is_ended_early = false;
+    for (size_t i = 0; i < segments_cnt; ++i) {
+        VideoFingerprint segment = segments.at(i).get();
+        if (is_ended_early) {
+            continue;
+        }
+        fingerprint.append(segment);
+        size_t end_frame_num = frames_cnt * (i + 1) / segments_cnt;
+        if (fingerprint.get_frames_cnt() < end_frame_num) {
+            out << "\nExtra break after frame "
+                << fingerprint.get_frames_cnt() << ". End of video?";
+            is_ended_early = true;
+        }
+    }
+    if (fingerprint.get_frames_cnt() == 0) {
+        throw std::runtime_error("Found no frames to process.");
+    }
+    // the borders are located anyway, only the next run has to decode again
+    try {
+        fingerprint.save(input_video_filename);
+    } catch (const std::runtime_error &e) {
+        out << "\n" << e.what();
+    }
+    return fingerprint;
+}
+
+VideoFingerprint KeyFramesExtractor::get_segment_fingerprint(
+    const QString &input_video_filename, size_t first_frame_num,
+    size_t end_frame_num, const std::function<void()> &on_frame_processed) {
+    cv::VideoCapture segment_cap;
+    try_open_video(segment_cap, input_video_filename);
+    if (first_frame_num > 0) {
+        seek_frame(segment_cap, input_video_filename, first_frame_num);
+    }
+    // the hash algorithms are taken from the pool instead of being
+    // initialized for every segment
+    std::unique_ptr<BorderFramesLocator> bfl = acquire_locator();
+    VideoFingerprint fingerprint;
+    cv::Mat frame;
+    for (size_t i = first_frame_num; i < end_frame_num; ++i) {
+        if (!grab_frame(segment_cap)) {
+            break;
+        }
+        double msec = segment_cap.get(cv::CAP_PROP_POS_MSEC);
+        retrieve_frame(segment_cap, frame);
+        bfl->append_fingerprint_frame(frame, msec, fingerprint);
+        on_frame_processed();
+    }
+    release_locator(std::move(bfl));
+    return fingerprint;
+}
+
+KeyFramesExtractor::SegmentBorders
+KeyFramesExtractor::locate_fingerprint_borders(
+    const VideoFingerprint &fingerprint) {
+    ProfileScope profile_scope("fingerprint borders",
+                               fingerprint.get_frames_cnt());
+    std::unique_ptr<BorderFramesLocator> bfl = acquire_locator();
+    SegmentBorders segment{{}, fingerprint.get_frames_cnt(), CascadeStats()};
+    for (size_t i = 0; i < fingerprint.get_frames_cnt(); ++i) {
+        if (bfl->compare_next_fingerprint_frame(fingerprint, i)) {
+            segment.borders.push_back(i);
+        }
+    }
+    segment.stats = bfl->take_stats();
+    release_locator(std::move(bfl));
+    return segment;
 }
 
 void KeyFramesExtractor::extract_key_frames(
     const QString &key_frames_directory) {
+    ProfileScope profile_scope("extract key frames");
     if (key_frame_nums.empty()) {
         throw std::logic_error("Error: no key frames found.");
     }
+    profile_scope.set_items(key_frame_nums.size());
     if (!cap.isOpened()) {
         throw std::logic_error("Error: video is not opened.");
     }
-    PercentPrinter printer;
+    // decoding stays on this thread, encoding and writing are done by the
+    // writers
+    KeyFramesWriter writer(key_frames_directory, settings);
+    PercentPrinter printer(out);
+    // once a seek turns out to be off, the remaining key frames are reached
+    // by decoding forward from the previous one
+    bool is_seeking_exact = true;
+    size_t next_frame_num = 0;
     for (size_t i = 0; i < key_frame_nums.size(); ++i) {
-        cap.set(cv::CAP_PROP_POS_FRAMES, key_frame_nums.at(i));
-        if (!cap.grab()) {
+        size_t key_frame_num = key_frame_nums.at(i);
+        if (is_seeking_exact && !try_seek_frame(cap, key_frame_num)) {
+            is_seeking_exact = false;
+            next_frame_num = std::numeric_limits<size_t>::max();
+        }
+        if (!is_seeking_exact) {
+            if (key_frame_num < next_frame_num) {
+                try_open_video(cap, input_video_filename);
+                next_frame_num = 0;
+            }
+            skip_frames(cap, input_video_filename, next_frame_num,
+                        key_frame_num);
+            next_frame_num = key_frame_num + 1;
+        }
+        if (!grab_frame(cap)) {
             throw std::runtime_error(
                 "Error: reached end of video before end of extraction.");
         }
         cv::Mat curr_frame;
-        cap.retrieve(curr_frame);
-        QString key_frame_filename =
-            key_frames_directory + "/" +
-            QTime::fromMSecsSinceStartOfDay(cap.get(cv::CAP_PROP_POS_MSEC))
-                .toString(timestamp_format) +
-            ".jpg";
-        cv::imwrite(key_frame_filename.toStdString(), curr_frame);
+        retrieve_frame(cap, curr_frame);
+        writer.write(curr_frame, key_frame_msecs.empty()
+                                     ? cap.get(cv::CAP_PROP_POS_MSEC)
+                                     : key_frame_msecs.at(i));
         printer.print_if_percent_changed(
             i + 1, key_frame_nums.size(),
             "\rExtracting key frames (stage 2 of 2)... ", "%");
     }
-    std::cout << "\n";
+    writer.finish();
+    out << "\n";
 }
 
-void extract_key_frames(const QString &input_video_filename,
-                        const QString &output_directory) {
-    check_file_exists(input_video_filename);
+void KeyFramesExtractor::locate_and_extract_key_frames(
+    const QString &input_video_filename, const QString &key_frames_directory) {
+    ProfileScope profile_scope("single pass");
+    key_frame_nums.clear();
+    key_frame_msecs.clear();
+    try_open_video(cap, input_video_filename);
+    size_t frames_cnt = cap.get(cv::CAP_PROP_FRAME_COUNT);
+    if (frames_cnt == 0) {
+        throw std::runtime_error("Found no frames to process.");
+    }
+    profile_scope.set_items(frames_cnt);
+    out << "Found " << frames_cnt << " frames to process.\n";
+    PercentPrinter printer(out);
+    std::unique_ptr<BorderFramesLocator> bfl = acquire_locator();
+    KeyFrameCandidates candidates(settings.single_pass_memory_budget);
+    KeyFramesWriter writer(key_frames_directory, settings);
+    auto write_scene_key_frame = [&](size_t scene_last_frame_num) {
+        const KeyFrameCandidate &key_frame =
+            candidates.get_middle_frame(scene_last_frame_num);
+        // candidates are cloned frames, hence the writers may share them
+        writer.write(key_frame.frame, key_frame.msec);
+        key_frame_nums.push_back(key_frame.frame_num);
+    };
+    cv::Mat frame;
+    size_t frames_decoded = 0;
+    for (size_t i = 0; i < frames_cnt; ++i) {
+        if (!grab_frame(cap)) {
+            out << "\nExtra break after frame " << i << ". End of video?";
+            break;
+        }
+        double msec = cap.get(cv::CAP_PROP_POS_MSEC);
+        retrieve_frame(cap, frame);
+        ++frames_decoded;
+        if (bfl->compare_next_frame(frame)) {
+            write_scene_key_frame(i);
+            candidates.start_scene(i);
+        }
+        candidates.add_frame(i, msec, frame);
+        printer.print_if_percent_changed(
+            i + 1, frames_cnt, "\rExtracting key frames (single pass)... ",
+            "%");
+    }
+    if (frames_decoded == 0) {
+        throw std::runtime_error("Found no frames to process.");
+    }
+    // same as the last border of the two stages pass unless the video ended
+    // earlier than reported
+    write_scene_key_frame(frames_decoded - 1);
+    writer.finish();
+    out << "\nExtracted " << key_frame_nums.size() << " key frames.\n";
+    cascade_stats = bfl->take_stats();
+    release_locator(std::move(bfl));
+    if (settings.print_cascade_stats) {
+        print_cascade_stats(out, cascade_stats);
+    }
+}
+
+const std::vector<size_t> &KeyFramesExtractor::get_key_frame_nums() const {
+    return key_frame_nums;
+}
+
+const CascadeStats &KeyFramesExtractor::get_cascade_stats() const {
+    return cascade_stats;
+}
+
+std::unique_ptr<BorderFramesLocator> KeyFramesExtractor::acquire_locator() {
+    std::lock_guard<std::mutex> lock(locators_mutex);
+    if (free_locators.empty()) {
+        return std::make_unique<BorderFramesLocator>(settings.cascade_order,
+                                                     settings.thresholds);
+    }
+    std::unique_ptr<BorderFramesLocator> bfl = std::move(free_locators.back());
+    free_locators.pop_back();
+    return bfl;
+}
+
+void KeyFramesExtractor::release_locator(
+    std::unique_ptr<BorderFramesLocator> bfl) {
+    // the next segment must not compare its first frame with this one
+    bfl->reset();
+    std::lock_guard<std::mutex> lock(locators_mutex);
+    free_locators.push_back(std::move(bfl));
+}
+
+static QString get_key_frames_directory(const QString &output_directory) {
     check_directory_exists(output_directory);
     static const QString datetimestamp_format =
         "yyyy-MM-ddT" + timestamp_format;
-    QString key_frames_directory(
-        output_directory + "/" +
-        QDateTime::currentDateTime().toString(datetimestamp_format));
+    return output_directory + "/" +
+           QDateTime::currentDateTime().toString(datetimestamp_format);
+}
+
+static void extract_video_key_frames(KeyFramesExtractor &kfe,
+                                     const QString &input_video_filename,
+                                     const QString &key_frames_directory,
+                                     const ExtractionSettings &settings) {
+    check_file_exists(input_video_filename);
+    if (settings.single_pass && !settings.use_fingerprint &&
+        (settings.sampling_step > 1 || settings.use_ffmpeg_decoder)) {
+        throw std::invalid_argument(
+            "Single pass does not support sampling and the FFmpeg decoder.");
+    }
+    // the other modes do not decode the frames with the FFmpeg decoder
+    if (settings.validate_ffmpeg_decoder &&
+        (!settings.use_ffmpeg_decoder || settings.single_pass ||
+         settings.use_fingerprint || settings.sampling_step > 1)) {
+        throw std::invalid_argument(
+            "FFmpeg decoder validation requires the FFmpeg decoder without "
+            "single pass, fingerprint and sampling.");
+    }
     try_create_directory(key_frames_directory);
-    KeyFramesExtractor kfe;
+    if (settings.single_pass && !settings.use_fingerprint) {
+        kfe.locate_and_extract_key_frames(input_video_filename,
+                                          key_frames_directory);
+        return;
+    }
     kfe.locate_key_frames(input_video_filename);
     kfe.extract_key_frames(key_frames_directory);
 }
+
+// videos with the same name are told apart by their position in the batch
+static QStringList
+get_video_directory_names(const QStringList &input_video_filenames) {
+    QStringList names;
+    for (qsizetype i = 0; i < input_video_filenames.size(); ++i) {
+        QString name =
+            QFileInfo(input_video_filenames.at(i)).completeBaseName();
+        if (names.contains(name)) {
+            name += "-" + QString::number(i + 1);
+        }
+        names.push_back(name);
+    }
+    return names;
+}
+
+void extract_key_frames(const QString &input_video_filename,
+                        const QString &output_directory,
+                        const ExtractionSettings &settings) {
+    check_file_exists(input_video_filename);
+    // rejects an unsupported format before creating the directory
+    get_image_write_params(settings.output_format, settings.output_quality);
+    KeyFramesExtractor kfe(settings);
+    extract_video_key_frames(kfe, input_video_filename,
+                             get_key_frames_directory(output_directory),
+                             settings);
+}
+
+std::vector<VideoExtractionResult>
+extract_key_frames_batch(const QStringList &input_video_filenames,
+                         const QString &output_directory,
+                         const ExtractionSettings &settings) {
+    // an empty directory would look like a batch of failed videos
+    if (input_video_filenames.isEmpty()) {
+        throw std::invalid_argument("Found no videos in the batch.");
+    }
+    get_image_write_params(settings.output_format, settings.output_quality);
+    QString batch_directory = get_key_frames_directory(output_directory);
+    try_create_directory(batch_directory);
+    QStringList video_directory_names =
+        get_video_directory_names(input_video_filenames);
+    // the progress of concurrent videos would interleave, the cascade stats
+    // are printed along with the completion of every video instead
+    ExtractionSettings video_settings = settings;
+    video_settings.print_progress = false;
+    video_settings.print_cascade_stats = false;
+    std::vector<VideoExtractionResult> results(input_video_filenames.size());
+    std::atomic<size_t> next_video_idx(0);
+    size_t videos_completed = 0;
+    std::mutex output_mutex;
+    // every worker keeps one extractor, and thus its hash algorithms, for all
+    // of its videos
+    auto extract_videos_key_frames = [&]() {
+        KeyFramesExtractor kfe(video_settings);
+        for (size_t i = next_video_idx++; i < results.size();
+             i = next_video_idx++) {
+            VideoExtractionResult &result = results.at(i);
+            result.input_video_filename = input_video_filenames.at(i);
+            try {
+                extract_video_key_frames(kfe, result.input_video_filename,
+                                         batch_directory + "/" +
+                                             video_directory_names.at(i),
+                                         video_settings);
+                result.key_frames_cnt = kfe.get_key_frame_nums().size();
+            } catch (const std::exception &e) {
+                result.error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "[" << ++videos_completed << "/" << results.size()
+                      << "] " << result.input_video_filename.toStdString()
+                      << ": ";
+            if (result.error.isEmpty()) {
+                std::cout << result.key_frames_cnt << " key frames.\n";
+                if (settings.print_cascade_stats) {
+                    print_cascade_stats(std::cout, kfe.get_cascade_stats());
+                }
+            } else {
+                std::cout << result.error.toStdString() << "\n";
+            }
+        }
+    };
+    size_t workers_cnt = std::max<size_t>(
+        1, std::min(settings.videos_threads_cnt, results.size()));
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < workers_cnt; ++i) {
+        workers.emplace_back(extract_videos_key_frames);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return results;
+}
+
+std::vector<size_t> locate_key_frames(const QString &input_video_filename,
+                                      const ExtractionSettings &settings) {
+    check_file_exists(input_video_filename);
+    KeyFramesExtractor kfe(settings);
+    kfe.locate_key_frames(input_video_filename);
+    return kfe.get_key_frame_nums();
+}
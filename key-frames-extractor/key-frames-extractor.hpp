@@ -1,16 +1,90 @@
 #ifndef KEY_FRAMES_EXTRACTOR_HPP
 #define KEY_FRAMES_EXTRACTOR_HPP
 
+#include <hash-handler/bounded-queue.hpp>
 #include <hash-handler/hash-handler.hpp>
 
+#include "video-fingerprint.hpp"
+#ifdef IMG_HASH_TOOLS_FFMPEG_DECODER
+#include "ffmpeg-thumbnails-decoder.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <thread>
 
 #include <QDir>
 #include <QTime>
 
 #include <opencv2/imgproc.hpp>
 
+struct ExtractionSettings {
+    // segments of the video searched for key frames in parallel
+    size_t threads_cnt = 1;
+    // compare every sampling_step-th frame and decode the frames in between
+    // only around a detected border
+    size_t sampling_step = 1;
+    // decode the video once keeping key frame candidates in memory instead of
+    // seeking back to every key frame, always single-threaded
+    bool single_pass = false;
+    size_t single_pass_memory_budget = 512 * 1024 * 1024;
+    // order of AverageHash, PHash, ColorMomentHash and RadialVarianceHash
+    // evaluation, empty for ordering by the measured cost per decision
+    QStringList cascade_order;
+    bool print_cascade_stats = false;
+    // thresholds of AverageHash, PHash, ColorMomentHash and
+    // RadialVarianceHash, empty for the defaults
+    std::vector<double> thresholds;
+    // locate the borders from the sidecar fingerprint of the video, saving
+    // it first if it is missing or outdated, instead of sampling or single
+    // pass
+    bool use_fingerprint = false;
+    // decode the frames for locating key frames with libavcodec straight into
+    // thumbnails, available if built with IMG_HASH_TOOLS_FFMPEG_DECODER
+    bool use_ffmpeg_decoder = false;
+    // locate the borders again with cv::VideoCapture and report where they
+    // differ from the FFmpeg decoder ones, which are kept
+    bool validate_ffmpeg_decoder = false;
+    // threads encoding and writing key frames
+    size_t writer_threads_cnt = 1;
+    // jpg, png or webp
+    QString output_format = "jpg";
+    // JPEG and WebP quality from 1 to 100, PNG is lossless
+    size_t output_quality = 95;
+    // videos of a batch processed in parallel
+    size_t videos_threads_cnt = 1;
+    bool print_progress = true;
+};
+
+struct VideoExtractionResult {
+    QString input_video_filename;
+    size_t key_frames_cnt = 0;
+    // empty if the key frames were extracted
+    QString error;
+};
+
 void extract_key_frames(const QString &input_video_filename,
-                        const QString &output_directory);
+                        const QString &output_directory,
+                        const ExtractionSettings &settings);
+
+// Extracts the key frames of every video into its own subdirectory of a
+// single timestamped directory. A failed video is reported in its result and
+// does not stop the others, an empty batch is an error.
+std::vector<VideoExtractionResult>
+extract_key_frames_batch(const QStringList &input_video_filenames,
+                         const QString &output_directory,
+                         const ExtractionSettings &settings);
+
+// stage 1 only, returns the key frame numbers without writing the frames
+std::vector<size_t> locate_key_frames(const QString &input_video_filename,
+                                      const ExtractionSettings &settings);
 
 #endif // KEY_FRAMES_EXTRACTOR_HPP
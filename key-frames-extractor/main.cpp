@@ -1,6 +1,95 @@
 #include "key-frames-extractor.hpp"
 
 #include <QCommandLineParser>
+#include <QDirIterator>
+#include <QTextStream>
+
+static size_t get_positive_number(QCommandLineParser &parser,
+                                  const QCommandLineOption &option) {
+    bool is_valid = false;
+    uint number = parser.value(option).toUInt(&is_valid);
+    if (!is_valid || number == 0) {
+        std::cout << "Error: invalid " << option.valueName().toStdString()
+                  << "." << "\n";
+        parser.showHelp(EXIT_FAILURE);
+    }
+    return number;
+}
+
+static std::vector<double> get_thresholds(QCommandLineParser &parser,
+                                          const QCommandLineOption &option) {
+    std::vector<double> thresholds;
+    for (const auto &value : parser.value(option).split(",")) {
+        bool is_valid = false;
+        thresholds.push_back(value.trimmed().toDouble(&is_valid));
+        if (!is_valid) {
+            std::cout << "Error: invalid " << option.valueName().toStdString()
+                      << "." << "\n";
+            parser.showHelp(EXIT_FAILURE);
+        }
+    }
+    return thresholds;
+}
+
+// the cores are shared by the videos processed in parallel
+static size_t get_default_threads_cnt(size_t videos_threads_cnt) {
+    return std::max<size_t>(1, std::thread::hardware_concurrency() /
+                                   videos_threads_cnt);
+}
+
+// a directory is searched for videos recursively, a list file has a video
+// filename on every line
+static QStringList get_input_video_filenames(const QString &batch) {
+    QStringList input_video_filenames;
+    if (QFileInfo(batch).isDir()) {
+        QDirIterator dir_it(batch,
+                            QStringList() << "*.mp4" << "*.mkv" << "*.avi"
+                                          << "*.mov" << "*.webm" << "*.m4v"
+                                          << "*.mpg" << "*.mpeg" << "*.wmv",
+                            QDir::Files, QDirIterator::Subdirectories);
+        while (dir_it.hasNext()) {
+            input_video_filenames.push_back(dir_it.next());
+        }
+        // the order of the batch does not depend on the file system
+        input_video_filenames.sort();
+        return input_video_filenames;
+    }
+    QFile list_file(batch);
+    if (!list_file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        throw std::runtime_error("Unable to open '" + batch.toStdString() +
+                                 "'.");
+    }
+    QTextStream in(&list_file);
+    while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if (!line.isEmpty()) {
+            input_video_filenames.push_back(line);
+        }
+    }
+    return input_video_filenames;
+}
+
+static bool print_batch_summary(
+    const std::vector<VideoExtractionResult> &results) {
+    size_t failures_cnt = 0;
+    for (const auto &result : results) {
+        if (!result.error.isEmpty()) {
+            ++failures_cnt;
+        }
+    }
+    std::cout << "Extracted key frames from " << results.size() - failures_cnt
+              << " of " << results.size() << " videos.\n";
+    if (failures_cnt > 0) {
+        std::cout << "Failed videos:\n";
+        for (const auto &result : results) {
+            if (!result.error.isEmpty()) {
+                std::cout << "  " << result.input_video_filename.toStdString()
+                          << ": " << result.error.toStdString() << "\n";
+            }
+        }
+    }
+    return failures_cnt == 0;
+}
 
 int main(int argc, char *argv[]) {
     QCoreApplication app(argc, argv);
@@ -9,19 +98,179 @@ int main(int argc, char *argv[]) {
     QCommandLineOption input_video_filename_option(
         "i", "Sets input video filename.", "input video filename");
     parser.addOption(input_video_filename_option);
+    QCommandLineOption batch_option(
+        "batch",
+        "Extracts key frames of every video in a directory or listed in a "
+        "file, one filename per line. Replaces -i.",
+        "directory or list filename");
+    parser.addOption(batch_option);
+    QCommandLineOption videos_threads_option(
+        "videos", "Sets count of videos processed in parallel in batch mode.",
+        "threads", "1");
+    parser.addOption(videos_threads_option);
     QCommandLineOption output_directory_option("o", "Sets output directory.",
                                                "output directory");
     parser.addOption(output_directory_option);
+    QCommandLineOption threads_option(
+        "j",
+        "Sets threads count for locating key frames. Defaults to the cores "
+        "count divided by the count of videos processed in parallel.",
+        "threads", QString::number(get_default_threads_cnt(1)));
+    parser.addOption(threads_option);
+    QCommandLineOption sampling_step_option(
+        "step",
+        "Compares only every n-th frame and rescans frames in between around "
+        "detected borders.",
+        "n", "1");
+    parser.addOption(sampling_step_option);
+    QCommandLineOption cascade_order_option(
+        "cascade",
+        "Sets fixed comparison order of AverageHash, PHash, ColorMomentHash "
+        "and RadialVarianceHash separated by commas. By default the order "
+        "adapts to the measured cost per decision.",
+        "hashes");
+    parser.addOption(cascade_order_option);
+    QCommandLineOption cascade_stats_option(
+        "cascade-stats", "Prints evaluations, hits and cost of every hash.");
+    parser.addOption(cascade_stats_option);
+    QCommandLineOption thresholds_option(
+        "thresholds",
+        "Sets thresholds of AverageHash, PHash, ColorMomentHash and "
+        "RadialVarianceHash separated by commas.",
+        "thresholds");
+    parser.addOption(thresholds_option);
+    QCommandLineOption fingerprint_option(
+        "fingerprint",
+        "Locates key frames from the hashes saved next to the video, saving "
+        "them first if missing or outdated.");
+    parser.addOption(fingerprint_option);
+    QCommandLineOption ffmpeg_decoder_option(
+        "ffmpeg-decoder",
+        "Decodes frames for locating key frames with libavcodec straight into "
+        "thumbnails, at a reduced resolution where the codec supports it.");
+    parser.addOption(ffmpeg_decoder_option);
+    QCommandLineOption validate_ffmpeg_decoder_option(
+        "validate-ffmpeg-decoder",
+        "Locates key frames with both the FFmpeg decoder and OpenCV and "
+        "reports the borders where they differ. Implies --ffmpeg-decoder, not "
+        "combinable with --batch, --single-pass, --fingerprint and --step.");
+    parser.addOption(validate_ffmpeg_decoder_option);
+    QCommandLineOption single_pass_option(
+        "single-pass",
+        "Decodes the video once keeping key frame candidates in memory, on a "
+        "single thread. Not combinable with -j, --step and --ffmpeg-decoder.");
+    parser.addOption(single_pass_option);
+    QCommandLineOption memory_budget_option(
+        "memory-budget", "Sets memory budget for single pass mode in MB.",
+        "megabytes", "512");
+    parser.addOption(memory_budget_option);
+    QCommandLineOption writer_threads_option(
+        "writers",
+        "Sets threads count for encoding and writing key frames. Defaults to "
+        "the cores count divided by the count of videos processed in "
+        "parallel.",
+        "threads", QString::number(get_default_threads_cnt(1)));
+    parser.addOption(writer_threads_option);
+    QCommandLineOption output_format_option(
+        "format", "Sets key frames format, one of jpg, png and webp.",
+        "format", "jpg");
+    parser.addOption(output_format_option);
+    QCommandLineOption output_quality_option(
+        "quality", "Sets JPEG and WebP quality from 1 to 100.", "quality",
+        "95");
+    parser.addOption(output_quality_option);
+    QCommandLineOption profile_option(
+        "profile", "Prints time, items and bytes of every step.");
+    parser.addOption(profile_option);
+    QCommandLineOption trace_filename_option(
+        "trace", "Writes every step to a file in Chrome trace format.",
+        "trace filename");
+    parser.addOption(trace_filename_option);
     parser.process(app);
-    if (!parser.isSet(input_video_filename_option)) {
-        std::cout << "Error: input video filename is not set." << "\n";
+    if (parser.isSet(input_video_filename_option) ==
+        parser.isSet(batch_option)) {
+        std::cout << "Error: either input video filename or batch must be set."
+                  << "\n";
         parser.showHelp(EXIT_FAILURE);
     }
     if (!parser.isSet(output_directory_option)) {
         std::cout << "Error: output directory is not set." << "\n";
         parser.showHelp(EXIT_FAILURE);
     }
-    extract_key_frames(parser.value(input_video_filename_option),
-                       parser.value(output_directory_option));
-    return EXIT_SUCCESS;
+    // single pass decodes sequentially with OpenCV, so these would be ignored
+    if (parser.isSet(single_pass_option) &&
+        (parser.isSet(threads_option) || parser.isSet(sampling_step_option) ||
+         parser.isSet(ffmpeg_decoder_option))) {
+        std::cout << "Error: single pass is not combinable with -j, --step "
+                     "and --ffmpeg-decoder."
+                  << "\n";
+        parser.showHelp(EXIT_FAILURE);
+    }
+    if (parser.isSet(validate_ffmpeg_decoder_option) &&
+        (parser.isSet(batch_option) || parser.isSet(single_pass_option) ||
+         parser.isSet(fingerprint_option) ||
+         parser.isSet(sampling_step_option))) {
+        std::cout << "Error: FFmpeg decoder validation is not combinable with "
+                     "--batch, --single-pass, --fingerprint and --step."
+                  << "\n";
+        parser.showHelp(EXIT_FAILURE);
+    }
+    ExtractionSettings settings;
+    settings.videos_threads_cnt =
+        get_positive_number(parser, videos_threads_option);
+    settings.threads_cnt =
+        parser.isSet(threads_option)
+            ? get_positive_number(parser, threads_option)
+            : get_default_threads_cnt(settings.videos_threads_cnt);
+    settings.sampling_step = get_positive_number(parser, sampling_step_option);
+    if (parser.isSet(cascade_order_option)) {
+        settings.cascade_order = parser.value(cascade_order_option).split(",");
+    }
+    settings.print_cascade_stats = parser.isSet(cascade_stats_option);
+    if (parser.isSet(thresholds_option)) {
+        settings.thresholds = get_thresholds(parser, thresholds_option);
+    }
+    settings.use_fingerprint = parser.isSet(fingerprint_option);
+    settings.validate_ffmpeg_decoder =
+        parser.isSet(validate_ffmpeg_decoder_option);
+    settings.use_ffmpeg_decoder = parser.isSet(ffmpeg_decoder_option) ||
+                                  settings.validate_ffmpeg_decoder;
+    settings.single_pass = parser.isSet(single_pass_option);
+    settings.single_pass_memory_budget =
+        get_positive_number(parser, memory_budget_option) * 1024 * 1024;
+    settings.writer_threads_cnt =
+        parser.isSet(writer_threads_option)
+            ? get_positive_number(parser, writer_threads_option)
+            : get_default_threads_cnt(settings.videos_threads_cnt);
+    settings.output_format = parser.value(output_format_option).toLower();
+    settings.output_quality =
+        get_positive_number(parser, output_quality_option);
+    if (parser.isSet(profile_option) || parser.isSet(trace_filename_option)) {
+        Profiler::enable(parser.isSet(trace_filename_option));
+    }
+    bool is_succeeded = true;
+    try {
+        if (parser.isSet(batch_option)) {
+            std::vector<VideoExtractionResult> results =
+                extract_key_frames_batch(
+                    get_input_video_filenames(parser.value(batch_option)),
+                    parser.value(output_directory_option), settings);
+            is_succeeded = print_batch_summary(results);
+        } else {
+            extract_key_frames(parser.value(input_video_filename_option),
+                               parser.value(output_directory_option),
+                               settings);
+        }
+        if (parser.isSet(profile_option)) {
+            Profiler::print_summary(std::cout);
+        }
+        if (parser.isSet(trace_filename_option)) {
+            Profiler::write_trace(
+                parser.value(trace_filename_option).toStdString());
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return is_succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
 }
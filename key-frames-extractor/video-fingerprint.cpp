@@ -0,0 +1,150 @@
+#include "video-fingerprint.hpp"
+
+#include <hash-handler/profiler.hpp>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <stdexcept>
+
+static const quint32 fingerprint_magic = 0x4b464650;
+// 2: the timestamps and every hash are stored column by column
+// 3: PHash transforms the whole batch by loops of a fixed summation order
+static const quint32 fingerprint_version = 3;
+static const qint32 max_hash_cols = 1024;
+
+QString VideoFingerprint::get_filename(const QString &video_filename) {
+    return video_filename + ".fingerprint";
+}
+
+bool VideoFingerprint::load(const QString &video_filename) {
+    ProfileScope profile_scope("fingerprint load", 0);
+    msecs.clear();
+    hashes.fill(cv::Mat());
+    QFile file(get_filename(video_filename));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    profile_scope.add_bytes(file.size());
+    QFileInfo video_info(video_filename);
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 size = 0;
+    qint64 mtime = 0;
+    quint64 frames_cnt = 0;
+    in >> magic >> version >> size >> mtime >> frames_cnt;
+    if (magic != fingerprint_magic || version != fingerprint_version ||
+        size != video_info.size() ||
+        mtime != video_info.lastModified().toMSecsSinceEpoch() ||
+        frames_cnt == 0) {
+        return false;
+    }
+    std::array<qint32, hashes_cnt> cols;
+    std::array<qint32, hashes_cnt> types;
+    // the timestamp and every hash of a frame
+    quint64 frame_bytes_cnt = sizeof(double);
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        in >> cols.at(i) >> types.at(i);
+        if (cols.at(i) <= 0 || cols.at(i) > max_hash_cols ||
+            types.at(i) != CV_MAT_TYPE(types.at(i))) {
+            return false;
+        }
+        frame_bytes_cnt += cols.at(i) * CV_ELEM_SIZE(types.at(i));
+    }
+    // a corrupted frames count must not allocate more than the file holds
+    if (in.status() != QDataStream::Ok ||
+        frames_cnt > static_cast<quint64>(file.size() - file.pos()) /
+                         frame_bytes_cnt) {
+        return false;
+    }
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        hashes.at(i).create(frames_cnt, cols.at(i), types.at(i));
+    }
+    msecs.resize(frames_cnt);
+    for (quint64 i = 0; i < frames_cnt && in.status() == QDataStream::Ok;
+         ++i) {
+        in >> msecs.at(i);
+    }
+    // freshly created matrices are continuous
+    for (auto &hash : hashes) {
+        qint64 bytes_cnt = hash.total() * hash.elemSize();
+        if (in.readRawData(reinterpret_cast<char *>(hash.data), bytes_cnt) !=
+            bytes_cnt) {
+            in.setStatus(QDataStream::ReadPastEnd);
+        }
+    }
+    if (in.status() != QDataStream::Ok) {
+        msecs.clear();
+        hashes.fill(cv::Mat());
+        return false;
+    }
+    profile_scope.set_items(frames_cnt);
+    return true;
+}
+
+void VideoFingerprint::save(const QString &video_filename) const {
+    ProfileScope profile_scope("fingerprint save", msecs.size());
+    // the hash matrices would have no columns to store
+    if (msecs.empty()) {
+        throw std::logic_error("Unable to save an empty fingerprint.");
+    }
+    QString fingerprint_filename = get_filename(video_filename);
+    QFileInfo video_info(video_filename);
+    QSaveFile file(fingerprint_filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        throw std::runtime_error("Unable to write fingerprint to '" +
+                                 fingerprint_filename.toStdString() + "'.");
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << fingerprint_magic << fingerprint_version << video_info.size()
+        << video_info.lastModified().toMSecsSinceEpoch()
+        << static_cast<quint64>(msecs.size());
+    for (const auto &hash : hashes) {
+        out << static_cast<qint32>(hash.cols)
+            << static_cast<qint32>(hash.type());
+    }
+    for (double msec : msecs) {
+        out << msec;
+    }
+    for (const auto &hash : hashes) {
+        cv::Mat continuous_hash = hash.isContinuous() ? hash : hash.clone();
+        out.writeRawData(
+            reinterpret_cast<const char *>(continuous_hash.data),
+            continuous_hash.total() * continuous_hash.elemSize());
+    }
+    if (!file.commit()) {
+        throw std::runtime_error("Unable to write fingerprint to '" +
+                                 fingerprint_filename.toStdString() + "'.");
+    }
+    profile_scope.add_bytes(QFileInfo(fingerprint_filename).size());
+}
+
+void VideoFingerprint::append(double msec,
+                              const std::array<cv::Mat, hashes_cnt> &hashes) {
+    msecs.push_back(msec);
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        this->hashes.at(i).push_back(hashes.at(i).reshape(1, 1));
+    }
+}
+
+void VideoFingerprint::append(const VideoFingerprint &other) {
+    msecs.insert(msecs.end(), other.msecs.begin(), other.msecs.end());
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        hashes.at(i).push_back(other.hashes.at(i));
+    }
+}
+
+size_t VideoFingerprint::get_frames_cnt() const { return msecs.size(); }
+
+double VideoFingerprint::get_msec(size_t frame_num) const {
+    return msecs.at(frame_num);
+}
+
+cv::Mat VideoFingerprint::get_hash(size_t hash_idx, size_t frame_num) const {
+    return hashes.at(hash_idx).row(frame_num);
+}
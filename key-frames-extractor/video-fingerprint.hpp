@@ -0,0 +1,37 @@
+#ifndef VIDEO_FINGERPRINT_HPP
+#define VIDEO_FINGERPRINT_HPP
+
+#include <QString>
+
+#include <array>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Hashes and timestamps of every frame of a video, kept in a sidecar file so
+// that the borders may be located again without decoding. Every hash matrix
+// has a row per frame and is stored as a single block after the timestamps.
+// A stored fingerprint is valid as long as its video keeps the same size and
+// modification time.
+class VideoFingerprint {
+public:
+    // AverageHash, PHash, ColorMomentHash and RadialVarianceHash
+    static const size_t hashes_cnt = 4;
+
+    static QString get_filename(const QString &video_filename);
+    // returns false if the file is missing, outdated or corrupted
+    bool load(const QString &video_filename);
+    // throws std::logic_error for a fingerprint without frames
+    void save(const QString &video_filename) const;
+    void append(double msec, const std::array<cv::Mat, hashes_cnt> &hashes);
+    void append(const VideoFingerprint &other);
+    size_t get_frames_cnt() const;
+    double get_msec(size_t frame_num) const;
+    cv::Mat get_hash(size_t hash_idx, size_t frame_num) const;
+
+private:
+    std::vector<double> msecs;
+    std::array<cv::Mat, hashes_cnt> hashes;
+};
+
+#endif // VIDEO_FINGERPRINT_HPP
@@ -0,0 +1,113 @@
+#include "directory-crawler.hpp"
+
+template <typename Char> static Char to_lower(Char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+DirectoryCrawler::DirectoryCrawler(const QStringList &extensions)
+    : busy_threads_cnt(0), is_stopped(false) {
+    for (const auto &extension : extensions) {
+        this->extensions.push_back(
+            std::filesystem::path(extension.toStdU16String()).native());
+    }
+}
+
+void DirectoryCrawler::crawl(
+    const QString &directory, size_t threads_cnt,
+    const std::function<bool(QString &&)> &on_file_found) {
+    pending_directories = {std::filesystem::path(directory.toStdU16String())};
+    busy_threads_cnt = 0;
+    is_stopped = false;
+    std::vector<std::thread> crawlers;
+    for (size_t i = 0; i < std::max<size_t>(1, threads_cnt); ++i) {
+        crawlers.emplace_back(&DirectoryCrawler::crawl_directories, this,
+                              std::cref(on_file_found));
+    }
+    for (auto &crawler : crawlers) {
+        crawler.join();
+    }
+}
+
+void DirectoryCrawler::crawl_directories(
+    const std::function<bool(QString &&)> &on_file_found) {
+    std::vector<std::filesystem::path> subdirectories;
+    while (true) {
+        std::filesystem::path directory;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            directories_changed.wait(lock, [this]() {
+                return is_stopped || !pending_directories.empty() ||
+                       busy_threads_cnt == 0;
+            });
+            if (is_stopped || pending_directories.empty()) {
+                return;
+            }
+            directory = std::move(pending_directories.back());
+            pending_directories.pop_back();
+            ++busy_threads_cnt;
+        }
+        ProfileScope profile_scope("list directory", 0);
+        size_t files_found_cnt = 0;
+        bool is_refused = false;
+        std::error_code ec;
+        // unreadable directories are skipped as by QDirIterator
+        for (std::filesystem::directory_iterator it(
+                 directory,
+                 std::filesystem::directory_options::skip_permission_denied,
+                 ec);
+             !ec && !is_refused &&
+             it != std::filesystem::directory_iterator();
+             it.increment(ec)) {
+            const std::filesystem::path::string_type &name =
+                it->path().native();
+            size_t name_offset = name.find_last_of(
+                std::filesystem::path::preferred_separator);
+            name_offset = name_offset == name.npos ? 0 : name_offset + 1;
+            if (name_offset < name.size() && name.at(name_offset) == '.') {
+                continue;
+            }
+            std::error_code entry_ec;
+            if (it->is_directory(entry_ec)) {
+                if (!it->is_symlink(entry_ec)) {
+                    subdirectories.push_back(it->path());
+                }
+            } else if (has_extension(name, name_offset) &&
+                       it->is_regular_file(entry_ec)) {
+                ++files_found_cnt;
+                is_refused = !on_file_found(QDir::fromNativeSeparators(
+                    QString::fromStdU16String(it->path().u16string())));
+            }
+        }
+        profile_scope.set_items(files_found_cnt);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (is_refused) {
+            is_stopped = true;
+            pending_directories.clear();
+        } else if (!is_stopped) {
+            pending_directories.insert(
+                pending_directories.end(),
+                std::make_move_iterator(subdirectories.begin()),
+                std::make_move_iterator(subdirectories.end()));
+        }
+        subdirectories.clear();
+        --busy_threads_cnt;
+        directories_changed.notify_all();
+    }
+}
+
+bool DirectoryCrawler::has_extension(
+    const std::filesystem::path::string_type &filename,
+    size_t name_offset) const {
+    for (const auto &extension : extensions) {
+        if (filename.size() - name_offset <= extension.size()) {
+            continue;
+        }
+        if (std::equal(extension.rbegin(), extension.rend(),
+                       filename.rbegin(), [](auto a, auto b) {
+                           return a == to_lower(b);
+                       })) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,51 @@
+#ifndef DIRECTORY_CRAWLER_HPP
+#define DIRECTORY_CRAWLER_HPP
+
+#include <hash-handler/profiler.hpp>
+
+#include <QDir>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Walks a directory tree on several threads, each listing the next pending
+// directory. Files are passed on as soon as they are found, in no particular
+// order. Like QDirIterator without QDir::Hidden, hidden entries are skipped
+// and symbolic links to directories are not followed. Extensions are matched
+// case-insensitively on the native names, so that a QString is only created
+// for the matching files.
+class DirectoryCrawler {
+public:
+    // extensions in lower case, including the dot
+    explicit DirectoryCrawler(const QStringList &extensions);
+    // blocks until the whole tree is walked, the callback is called from the
+    // crawling threads and stops the crawl by returning false
+    void crawl(const QString &directory, size_t threads_cnt,
+               const std::function<bool(QString &&)> &on_file_found);
+
+private:
+    void crawl_directories(
+        const std::function<bool(QString &&)> &on_file_found);
+    bool has_extension(const std::filesystem::path::string_type &filename,
+                       size_t name_offset) const;
+
+    std::vector<std::filesystem::path::string_type> extensions;
+    std::vector<std::filesystem::path> pending_directories;
+    // directories being listed, the crawl ends once there are none of them
+    // and nothing is pending
+    size_t busy_threads_cnt;
+    // set once the callback refuses a file, the pending directories are
+    // dropped then
+    bool is_stopped;
+    std::mutex mutex;
+    std::condition_variable directories_changed;
+};
+
+#endif // DIRECTORY_CRAWLER_HPP
@@ -0,0 +1,102 @@
+#include "files-prefetcher.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+FilesPrefetcher::FilesPrefetcher(BoundedQueue<QString> &filenames,
+                                 size_t queue_depth,
+                                 HashCache *hash_cache)
+    : filenames(filenames), hash_cache(hash_cache),
+      prefetched_files(queue_depth), free_buffers(queue_depth * 2),
+      active_readers_cnt(queue_depth) {
+    if (queue_depth == 0) {
+        throw std::invalid_argument("I/O queue depth must be positive.");
+    }
+    // a buffer for every reader and every read file waiting for a decoder
+    for (size_t i = 0; i < queue_depth * 2; ++i) {
+        free_buffers.push(std::vector<uchar>());
+    }
+    for (size_t i = 0; i < queue_depth; ++i) {
+        readers.emplace_back(&FilesPrefetcher::prefetch_files, this);
+    }
+}
+
+FilesPrefetcher::~FilesPrefetcher() {
+    filenames.close();
+    prefetched_files.close();
+    free_buffers.close();
+    for (auto &reader : readers) {
+        reader.join();
+    }
+}
+
+bool FilesPrefetcher::pop(PrefetchedFile &file) {
+    return prefetched_files.pop(file);
+}
+
+void FilesPrefetcher::recycle(std::vector<uchar> &&data) {
+    free_buffers.push(std::move(data));
+}
+
+void FilesPrefetcher::prefetch_files() {
+    try {
+        QString filename;
+        while (filenames.pop(filename)) {
+            PrefetchedFile file;
+            file.filename = std::move(filename);
+            {
+                ProfileScope stat_profile_scope("stat");
+                QFileInfo file_info(file.filename);
+                file.size = file_info.size();
+                file.mtime = file_info.lastModified().toMSecsSinceEpoch();
+            }
+            file.is_cached =
+                hash_cache != nullptr &&
+                hash_cache->find(file.filename, file.size, file.mtime,
+                                 file.cached_hash);
+            if (!file.is_cached && !read_file(file)) {
+                qDebug() << "Unable to read" << file.filename;
+            }
+            if (!prefetched_files.push(std::move(file))) {
+                break;
+            }
+        }
+    } catch (const std::exception &e) {
+        qDebug() << e.what();
+    }
+    if (--active_readers_cnt == 0) {
+        prefetched_files.close();
+    }
+}
+
+bool FilesPrefetcher::read_file(PrefetchedFile &file) {
+    std::vector<uchar> data;
+    if (!free_buffers.pop(data)) {
+        return false;
+    }
+    bool is_read = false;
+    {
+        ProfileScope profile_scope("read");
+        QFile device(file.filename);
+        if (device.open(QIODevice::ReadOnly) && device.size() > 0) {
+#ifdef __linux__
+            // widens the kernel read-ahead window for large files
+            posix_fadvise(device.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            // the buffer capacity is kept between files
+            data.resize(device.size());
+            is_read = device.read(reinterpret_cast<char *>(data.data()),
+                                  data.size()) ==
+                      static_cast<qint64>(data.size());
+            profile_scope.add_bytes(data.size());
+        }
+    }
+    if (!is_read) {
+        data.clear();
+        free_buffers.push(std::move(data));
+        return false;
+    }
+    file.data = std::move(data);
+    return true;
+}
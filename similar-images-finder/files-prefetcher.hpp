@@ -0,0 +1,58 @@
+#ifndef FILES_PREFETCHER_HPP
+#define FILES_PREFETCHER_HPP
+
+#include <hash-handler/bounded-queue.hpp>
+#include <hash-handler/profiler.hpp>
+
+#include "hash-cache.hpp"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct PrefetchedFile {
+    QString filename;
+    qint64 size = 0;
+    qint64 mtime = 0;
+    // whole contents, empty if the hash is cached or the file is unreadable
+    std::vector<uchar> data;
+    bool is_cached = false;
+    PackedHash cached_hash = 0;
+};
+
+// Reads the files whole on a pool of I/O threads ahead of their decoding, so
+// that the decoding threads do not wait for the disk. Every reader keeps one
+// request in flight, so the readers count is the I/O queue depth. Contents
+// are read into pooled buffers, which are returned once decoded.
+class FilesPrefetcher {
+public:
+    // the files with a hash in the cache are not read, the cache is not
+    // looked up if it is null
+    FilesPrefetcher(BoundedQueue<QString> &filenames, size_t queue_depth,
+                    HashCache *hash_cache);
+    // closes the filenames queue if the files are not drained yet
+    ~FilesPrefetcher();
+    // blocks until the next file is read, returns false once the filenames
+    // queue is closed and drained
+    bool pop(PrefetchedFile &file);
+    // has to be called for the contents of every popped file once decoded
+    void recycle(std::vector<uchar> &&data);
+
+private:
+    void prefetch_files();
+    bool read_file(PrefetchedFile &file);
+
+    BoundedQueue<QString> &filenames;
+    HashCache *hash_cache;
+    BoundedQueue<PrefetchedFile> prefetched_files;
+    BoundedQueue<std::vector<uchar>> free_buffers;
+    std::atomic<size_t> active_readers_cnt;
+    std::vector<std::thread> readers;
+};
+
+#endif // FILES_PREFETCHER_HPP
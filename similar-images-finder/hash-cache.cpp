@@ -0,0 +1,113 @@
+#include "hash-cache.hpp"
+
+static const quint32 cache_magic = 0x49484331;
+// 2: hashes of JPEGs come from reduced resolution decodes
+// 3: PHash is computed by the batched implementation
+// 4: entries keep a checksum of the file contents
+// 5: PHash transforms every thumbnail by products of fixed shapes
+// 6: hashes and checksums are stored packed
+// 7: entries no longer keep a checksum
+// 8: PHash transforms the whole batch by loops of a fixed summation order
+static const quint32 cache_version = 8;
+
+HashCache::HashCache(const QString &cache_filename,
+                     const QString &hash_algorithm_name)
+    : cache_filename(cache_filename),
+      hash_algorithm_name(hash_algorithm_name) {}
+
+void HashCache::load() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ProfileScope profile_scope("cache load", 0);
+    entries.clear();
+    QFile file(cache_filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    profile_scope.add_bytes(file.size());
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QString algorithm_name;
+    quint64 entries_cnt = 0;
+    in >> magic >> version >> algorithm_name >> entries_cnt;
+    if (magic != cache_magic || version != cache_version ||
+        algorithm_name != hash_algorithm_name) {
+        qDebug() << "Ignored incompatible hash cache" << cache_filename;
+        return;
+    }
+    for (quint64 i = 0; i < entries_cnt && in.status() == QDataStream::Ok;
+         ++i) {
+        QString filename;
+        Entry entry{0, 0, 0, false};
+        quint64 hash = 0;
+        in >> filename >> entry.size >> entry.mtime >> hash;
+        entry.hash = hash;
+        entries.insert(filename, entry);
+    }
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "Ignored corrupted hash cache" << cache_filename;
+        entries.clear();
+    }
+    profile_scope.set_items(entries.size());
+}
+
+void HashCache::save() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ProfileScope profile_scope("cache save", entries.size());
+    QDir().mkpath(QFileInfo(cache_filename).absolutePath());
+    QSaveFile file(cache_filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Unable to write hash cache" << cache_filename;
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << cache_magic << cache_version << hash_algorithm_name
+        << static_cast<quint64>(entries.size());
+    for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+        out << it.key() << it->size << it->mtime
+            << static_cast<quint64>(it->hash);
+    }
+    if (!file.commit()) {
+        qDebug() << "Unable to write hash cache" << cache_filename;
+    }
+}
+
+bool HashCache::find(const QString &filename, qint64 size, qint64 mtime,
+                     PackedHash &hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(filename);
+    if (it == entries.end() || it->size != size || it->mtime != mtime) {
+        return false;
+    }
+    it->is_listed = true;
+    hash = it->hash;
+    return true;
+}
+
+void HashCache::insert(const QString &filename, qint64 size, qint64 mtime,
+                       PackedHash hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.insert(filename, Entry{size, mtime, hash, true});
+}
+
+void HashCache::remove(const QString &filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.remove(filename);
+}
+
+void HashCache::remove_unlisted(const QString &directory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    QString prefix = QDir(directory).absolutePath();
+    if (!prefix.endsWith('/')) {
+        prefix += '/';
+    }
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it.key().startsWith(prefix) && !it->is_listed) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef HASH_CACHE_HPP
+#define HASH_CACHE_HPP
+
+#include <hash-handler/profiler.hpp>
+
+#include "hashes-pool.hpp"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QHash>
+#include <QSaveFile>
+
+#include <mutex>
+
+// Persistent store of computed hashes. A stored hash is reused as long as its
+// file keeps the same size and modification time.
+class HashCache {
+public:
+    HashCache(const QString &cache_filename,
+              const QString &hash_algorithm_name);
+    void load();
+    void save();
+    // found and inserted files are marked as listed by the scan
+    bool find(const QString &filename, qint64 size, qint64 mtime,
+              PackedHash &hash);
+    void insert(const QString &filename, qint64 size, qint64 mtime,
+                PackedHash hash);
+    void remove(const QString &filename);
+    // removes the files below the directory not listed since the load
+    void remove_unlisted(const QString &directory);
+
+private:
+    struct Entry {
+        qint64 size;
+        qint64 mtime;
+        PackedHash hash;
+        bool is_listed;
+    };
+
+    const QString cache_filename;
+    const QString hash_algorithm_name;
+    QHash<QString, Entry> entries;
+    mutable std::mutex mutex;
+};
+
+#endif // HASH_CACHE_HPP
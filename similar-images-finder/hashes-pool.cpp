@@ -0,0 +1,247 @@
+#include "hashes-pool.hpp"
+
+#include <QDir>
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+
+bool operator==(const ContentKey &a, const ContentKey &b) {
+    return a.size == b.size && a.digest == b.digest;
+}
+
+size_t qHash(const ContentKey &key, size_t seed) {
+    return qHashBits(key.digest.data(), key.digest.size(),
+                     qHash(key.size, seed));
+}
+
+HashesPool::HashesPool(size_t memory_budget)
+    : memory_budget(memory_budget), path_offsets{0}, mapped_arena(nullptr),
+      mapped_arena_size(0) {}
+
+uint32_t HashesPool::push_back(PackedHash hash, const QString &filename) {
+    if (hashes.size() >= std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many images in hashes pool.");
+    }
+    QByteArray path = filename.toUtf8();
+    hashes.push_back(hash);
+    original_ids.push_back(hashes.size() - 1);
+    path_offsets.push_back(path_offsets.back() + path.size());
+    if (spill_file != nullptr) {
+        if (spill_file->write(path) != path.size()) {
+            throw std::runtime_error("Unable to write hashes pool to '" +
+                                     spill_file->fileName().toStdString() +
+                                     "'.");
+        }
+    } else {
+        path_arena.insert(path_arena.end(), path.begin(), path.end());
+        if (get_memory_usage() > memory_budget) {
+            spill();
+        }
+    }
+    return hashes.size() - 1;
+}
+
+uint32_t HashesPool::push_back(PackedHash hash, const QString &filename,
+                               qint64 size) {
+    uint32_t id = push_back(hash, filename);
+    // a file of the same size may have been decoded concurrently
+    if (!size_groups.contains(size)) {
+        size_groups.insert(size, SizeGroup{id, false});
+    }
+    return id;
+}
+
+uint32_t HashesPool::push_back(PackedHash hash, const QString &filename,
+                               const ContentKey &contents) {
+    uint32_t id = push_back(hash, filename);
+    if (!size_groups.contains(contents.size)) {
+        size_groups.insert(contents.size, SizeGroup{id, true});
+    }
+    set_digest(id, contents);
+    return id;
+}
+
+bool HashesPool::find_size(qint64 size, uint32_t &id,
+                           bool &is_digested) const {
+    auto it = size_groups.constFind(size);
+    if (it == size_groups.cend()) {
+        return false;
+    }
+    id = it->first_id;
+    is_digested = it->is_digested;
+    return true;
+}
+
+void HashesPool::set_digest(uint32_t id, const ContentKey &contents) {
+    auto it = size_groups.find(contents.size);
+    if (it != size_groups.end() && it->first_id == id) {
+        it->is_digested = true;
+    }
+    // an image with the same contents may have been decoded concurrently,
+    // the identical hashes get the two united anyway
+    if (!content_ids.contains(contents)) {
+        content_ids.insert(contents, id);
+    }
+}
+
+bool HashesPool::push_back_copy(const QString &filename,
+                                const ContentKey &contents,
+                                PackedHash &hash) {
+    auto it = content_ids.constFind(contents);
+    if (it == content_ids.cend()) {
+        return false;
+    }
+    uint32_t original_id = *it;
+    hash = hashes.at(original_id);
+    uint32_t id = push_back(hash, filename);
+    original_ids.at(id) = original_id;
+    return true;
+}
+
+void HashesPool::release_contents() {
+    size_groups = {};
+    content_ids = {};
+}
+
+size_t HashesPool::size() const { return hashes.size(); }
+
+bool HashesPool::empty() const { return hashes.empty(); }
+
+const std::vector<PackedHash> &HashesPool::get_hashes() const {
+    return hashes;
+}
+
+QString HashesPool::get_filename(uint32_t id) const {
+    uint64_t begin = path_offsets.at(id);
+    uint64_t end = path_offsets.at(id + 1);
+    if (begin == end) {
+        return QString();
+    }
+    return QString::fromUtf8(get_paths() + begin, end - begin);
+}
+
+void HashesPool::sort_by_filename() {
+    ProfileScope profile_scope("pool sort", size());
+    std::vector<uint32_t> sorted_ids(size());
+    std::iota(sorted_ids.begin(), sorted_ids.end(), uint32_t(0));
+    if (path_offsets.back() > 0) {
+        const char *paths = get_paths();
+        auto get_path = [&](uint32_t id) {
+            return std::string_view(paths + path_offsets.at(id),
+                                    path_offsets.at(id + 1) -
+                                        path_offsets.at(id));
+        };
+        // UTF-8 compared bytewise keeps the code point order
+        std::sort(sorted_ids.begin(), sorted_ids.end(),
+                  [&](uint32_t a, uint32_t b) {
+                      int res = get_path(a).compare(get_path(b));
+                      return res < 0 || (res == 0 && a < b);
+                  });
+    }
+    std::vector<uint32_t> new_ids(size());
+    for (size_t i = 0; i < sorted_ids.size(); ++i) {
+        new_ids.at(sorted_ids.at(i)) = i;
+    }
+    // the first copy in the new order becomes the original of its contents,
+    // which otherwise depends on the order the workers pushed them in
+    std::vector<uint32_t> first_copy_ids(size(),
+                                         std::numeric_limits<uint32_t>::max());
+    for (size_t i = 0; i < size(); ++i) {
+        uint32_t &first_copy_id = first_copy_ids.at(original_ids.at(i));
+        first_copy_id = std::min(first_copy_id, new_ids.at(i));
+    }
+    std::vector<PackedHash> sorted_hashes(size());
+    std::vector<uint32_t> sorted_original_ids(size());
+    std::vector<uint64_t> sorted_path_offsets{0};
+    sorted_path_offsets.reserve(path_offsets.size());
+    std::vector<char> sorted_path_arena;
+    std::unique_ptr<QTemporaryFile> sorted_spill_file;
+    if (spill_file != nullptr) {
+        sorted_spill_file = std::make_unique<QTemporaryFile>(
+            QDir::tempPath() + "/hashes-pool-XXXXXX.bin");
+        if (!sorted_spill_file->open()) {
+            throw std::runtime_error(
+                "Unable to spill hashes pool to '" +
+                sorted_spill_file->fileName().toStdString() + "'.");
+        }
+    } else {
+        sorted_path_arena.reserve(path_arena.size());
+    }
+    const char *paths = path_offsets.back() > 0 ? get_paths() : nullptr;
+    for (size_t i = 0; i < sorted_ids.size(); ++i) {
+        uint32_t id = sorted_ids.at(i);
+        sorted_hashes.at(i) = hashes.at(id);
+        sorted_original_ids.at(i) = first_copy_ids.at(original_ids.at(id));
+        const char *path = paths + path_offsets.at(id);
+        uint64_t path_size = path_offsets.at(id + 1) - path_offsets.at(id);
+        sorted_path_offsets.push_back(sorted_path_offsets.back() + path_size);
+        if (sorted_spill_file == nullptr) {
+            sorted_path_arena.insert(sorted_path_arena.end(), path,
+                                     path + path_size);
+        } else if (sorted_spill_file->write(path, path_size) !=
+                   static_cast<qint64>(path_size)) {
+            throw std::runtime_error(
+                "Unable to write hashes pool to '" +
+                sorted_spill_file->fileName().toStdString() + "'.");
+        }
+    }
+    hashes = std::move(sorted_hashes);
+    original_ids = std::move(sorted_original_ids);
+    path_offsets = std::move(sorted_path_offsets);
+    path_arena = std::move(sorted_path_arena);
+    if (spill_file != nullptr) {
+        // closing the file unmaps it
+        mapped_arena = nullptr;
+        mapped_arena_size = 0;
+        spill_file = std::move(sorted_spill_file);
+    }
+}
+
+uint32_t HashesPool::get_original_id(uint32_t id) const {
+    return original_ids.at(id);
+}
+
+bool HashesPool::is_spilled() const { return spill_file != nullptr; }
+
+size_t HashesPool::get_memory_usage() const {
+    return hashes.capacity() * sizeof(PackedHash) +
+           path_offsets.capacity() * sizeof(uint64_t) + path_arena.capacity() +
+           original_ids.capacity() * sizeof(uint32_t) +
+           size_groups.capacity() * (sizeof(qint64) + sizeof(SizeGroup)) +
+           content_ids.capacity() * (sizeof(ContentKey) + sizeof(uint32_t));
+}
+
+const char *HashesPool::get_paths() const {
+    if (spill_file == nullptr) {
+        return path_arena.data();
+    }
+    if (mapped_arena == nullptr || mapped_arena_size < path_offsets.back()) {
+        if (mapped_arena != nullptr) {
+            spill_file->unmap(mapped_arena);
+        }
+        mapped_arena_size = path_offsets.back();
+        if (!spill_file->flush() ||
+            (mapped_arena = spill_file->map(0, mapped_arena_size)) ==
+                nullptr) {
+            throw std::runtime_error("Unable to map hashes pool from '" +
+                                     spill_file->fileName().toStdString() +
+                                     "'.");
+        }
+    }
+    return reinterpret_cast<const char *>(mapped_arena);
+}
+
+void HashesPool::spill() {
+    spill_file = std::make_unique<QTemporaryFile>(
+        QDir::tempPath() + "/hashes-pool-XXXXXX.bin");
+    if (!spill_file->open() ||
+        spill_file->write(path_arena.data(), path_arena.size()) !=
+            static_cast<qint64>(path_arena.size())) {
+        throw std::runtime_error("Unable to spill hashes pool to '" +
+                                 spill_file->fileName().toStdString() + "'.");
+    }
+    path_arena.clear();
+    path_arena.shrink_to_fit();
+}
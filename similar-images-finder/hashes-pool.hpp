@@ -0,0 +1,94 @@
+#ifndef HASHES_POOL_HPP
+#define HASHES_POOL_HPP
+
+#include <hash-handler/hash-handler.hpp>
+
+#include <QHash>
+#include <QTemporaryFile>
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// SHA-256 of the contents of a file
+typedef std::array<uchar, 32> ContentDigest;
+
+// files with the same size and digest are taken for copies
+struct ContentKey {
+    qint64 size;
+    ContentDigest digest;
+};
+
+bool operator==(const ContentKey &a, const ContentKey &b);
+size_t qHash(const ContentKey &key, size_t seed = 0);
+
+// Packed hashes and paths of the scanned images in columns addressed by
+// 32-bit ids. The UTF-8 paths lie back to back in a single arena. Once the
+// pool exceeds its memory budget, the arena moves to a temporary file and
+// is memory mapped for reading. The fixed-size columns are never spilled,
+// so the budget bounds the paths only. Images decoded from files of the
+// same size are told apart by the digests of the files, which are computed
+// only once the size collides. Images with the same contents are pushed as
+// copies of the first of them and take over its hash without being decoded.
+class HashesPool {
+public:
+    explicit HashesPool(
+        size_t memory_budget = std::numeric_limits<size_t>::max());
+    uint32_t push_back(PackedHash hash, const QString &filename);
+    // decoded from a file of the size, which is kept for the copies pushed
+    // later
+    uint32_t push_back(PackedHash hash, const QString &filename, qint64 size);
+    // decoded from a digested file
+    uint32_t push_back(PackedHash hash, const QString &filename,
+                       const ContentKey &contents);
+    // returns false unless an image was decoded from a file of the size,
+    // otherwise the first one of them has to be digested unless is_digested
+    bool find_size(qint64 size, uint32_t &id, bool &is_digested) const;
+    void set_digest(uint32_t id, const ContentKey &contents);
+    // returns false unless an image with the same contents was pushed,
+    // otherwise the copy is pushed with the hash of that image
+    bool push_back_copy(const QString &filename, const ContentKey &contents,
+                        PackedHash &hash);
+    // once no more copies are pushed
+    void release_contents();
+    size_t size() const;
+    bool empty() const;
+    // contiguous, indexed by id
+    const std::vector<PackedHash> &get_hashes() const;
+    QString get_filename(uint32_t id) const;
+    // the workers push the images in no particular order, sorting them by
+    // path keeps the ids the same from one scan to another
+    void sort_by_filename();
+    // the image a copy was pushed for, the image itself otherwise
+    uint32_t get_original_id(uint32_t id) const;
+    bool is_spilled() const;
+
+private:
+    struct SizeGroup {
+        uint32_t first_id;
+        bool is_digested;
+    };
+
+    // the whole arena, mapped if it is spilled
+    const char *get_paths() const;
+    size_t get_memory_usage() const;
+    void spill();
+
+    const size_t memory_budget;
+    std::vector<PackedHash> hashes;
+    // path of the image i is [path_offsets[i], path_offsets[i + 1])
+    std::vector<uint64_t> path_offsets;
+    std::vector<char> path_arena;
+    std::vector<uint32_t> original_ids;
+    // first image decoded from a file of every size
+    QHash<qint64, SizeGroup> size_groups;
+    // first image decoded from a digested file of given contents
+    QHash<ContentKey, uint32_t> content_ids;
+    std::unique_ptr<QTemporaryFile> spill_file;
+    // remapped once the file has grown past the mapped part
+    mutable uchar *mapped_arena;
+    mutable uint64_t mapped_arena_size;
+};
+
+#endif // HASHES_POOL_HPP
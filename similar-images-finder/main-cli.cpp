@@ -0,0 +1,267 @@
+#include "similar-images-scanner.hpp"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+class PercentPrinter {
+public:
+    PercentPrinter();
+    void print_if_percent_changed(double current, double total);
+    void set_prefix(const QString &prefix);
+
+private:
+    std::mutex mutex;
+    std::string prefix;
+    int displayed_percent;
+};
+
+} // namespace
+
+PercentPrinter::PercentPrinter() : displayed_percent(-1) {}
+
+void PercentPrinter::print_if_percent_changed(double current, double total) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int actual_percent = current / total * 100;
+    if (actual_percent != displayed_percent) {
+        std::cerr << "\r" << prefix << " " << actual_percent << "%"
+                  << std::flush;
+        displayed_percent = actual_percent;
+    }
+}
+
+void PercentPrinter::set_prefix(const QString &prefix) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (displayed_percent != -1) {
+        std::cerr << "\n";
+    }
+    this->prefix = prefix.toStdString();
+    displayed_percent = -1;
+}
+
+static QString get_csv_field(const QString &field) {
+    QString escaped_field = field;
+    escaped_field.replace("\"", "\"\"");
+    return "\"" + escaped_field + "\"";
+}
+
+static QByteArray
+get_json(const std::vector<SimilarityCluster> &similarity_clusters) {
+    QJsonArray clusters;
+    for (const auto &similarity_cluster : similarity_clusters) {
+        QJsonArray cluster;
+        for (const auto &filename : similarity_cluster) {
+            cluster.push_back(filename);
+        }
+        clusters.push_back(cluster);
+    }
+    QJsonObject root;
+    root.insert("clusters", clusters);
+    return QJsonDocument(root).toJson();
+}
+
+static QByteArray
+get_csv(const std::vector<SimilarityCluster> &similarity_clusters) {
+    QString csv;
+    QTextStream out(&csv);
+    out << "cluster,filename\n";
+    for (size_t i = 0; i < similarity_clusters.size(); ++i) {
+        for (const auto &filename : similarity_clusters.at(i)) {
+            out << i << "," << get_csv_field(filename) << "\n";
+        }
+    }
+    out.flush();
+    return csv.toUtf8();
+}
+
+static size_t get_number(const QString &value, const QString &name) {
+    bool ok = false;
+    uint number = value.toUInt(&ok);
+    if (!ok) {
+        throw std::invalid_argument("Invalid " + name.toStdString() + " '" +
+                                    value.toStdString() + "'.");
+    }
+    return number;
+}
+
+static void print_decode_drift(const DecodeDrift &decode_drift,
+                               size_t max_hashes_distance) {
+    size_t images_cnt = 0;
+    size_t distances_sum = 0;
+    size_t max_distance = 0;
+    size_t images_beyond_threshold_cnt = 0;
+    for (size_t i = 0; i < decode_drift.size(); ++i) {
+        images_cnt += decode_drift.at(i);
+        distances_sum += i * decode_drift.at(i);
+        if (decode_drift.at(i) > 0) {
+            max_distance = i;
+        }
+        if (i > max_hashes_distance) {
+            images_beyond_threshold_cnt += decode_drift.at(i);
+        }
+    }
+    if (images_cnt == 0) {
+        std::cerr << "No images decoded for drift validation.\n";
+        return;
+    }
+    std::cerr << "Hash drift of reduced decode over " << images_cnt
+              << " images: mean "
+              << static_cast<double>(distances_sum) / images_cnt << ", max "
+              << max_distance << ", beyond threshold "
+              << images_beyond_threshold_cnt << ".\n";
+    for (size_t i = 0; i < decode_drift.size(); ++i) {
+        if (decode_drift.at(i) > 0) {
+            std::cerr << "  distance " << i << ": " << decode_drift.at(i)
+                      << " images\n";
+        }
+    }
+}
+
+static void write_output(const QByteArray &data, const QString &filename) {
+    QFile file(filename);
+    bool is_opened = filename.isEmpty()
+                         ? file.open(stdout, QIODevice::WriteOnly)
+                         : file.open(QIODevice::WriteOnly);
+    if (!is_opened || file.write(data) != data.size()) {
+        throw std::runtime_error("Unable to write '" + filename.toStdString() +
+                                 "'.");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    // share the hash cache with the GUI
+    QCoreApplication::setApplicationName("similar-images-finder");
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption directory_option("d", "Sets directory to scan.",
+                                        "directory");
+    parser.addOption(directory_option);
+    QCommandLineOption algorithm_option(
+        "a", "Sets hash algorithm: PHash or AverageHash.", "algorithm",
+        "PHash");
+    parser.addOption(algorithm_option);
+    QCommandLineOption threshold_option(
+        "t", "Sets maximum Hamming distance between similar images.",
+        "threshold", "5");
+    parser.addOption(threshold_option);
+    QCommandLineOption threads_option(
+        "j", "Sets hashing threads count.", "threads",
+        QString::number(std::max(1u, std::thread::hardware_concurrency())));
+    parser.addOption(threads_option);
+    QCommandLineOption format_option("f", "Sets output format: json or csv.",
+                                     "format", "json");
+    parser.addOption(format_option);
+    QCommandLineOption output_filename_option(
+        "o", "Sets output filename, standard output by default.",
+        "output filename");
+    parser.addOption(output_filename_option);
+    QCommandLineOption brute_force_option(
+        "brute-force", "Compares every pair of images (reference mode).");
+    parser.addOption(brute_force_option);
+    QCommandLineOption full_decode_option(
+        "full-decode", "Decodes JPEGs at full resolution for hashing.");
+    parser.addOption(full_decode_option);
+    QCommandLineOption validate_decode_option(
+        "validate-decode",
+        "Decodes every image at full resolution as well and reports how much "
+        "the hashes drift. Ignores the cached hashes.");
+    parser.addOption(validate_decode_option);
+    QCommandLineOption memory_budget_option(
+        "memory-budget",
+        "Sets memory of the scanned images in MB past which their paths "
+        "spill to a temporary file. The hashes and the hash cache stay in "
+        "memory. Unlimited by default.",
+        "megabytes");
+    parser.addOption(memory_budget_option);
+    QCommandLineOption io_depth_option(
+        "io-depth", "Sets count of files read ahead of decoding at once.",
+        "files", "8");
+    parser.addOption(io_depth_option);
+    QCommandLineOption profile_option(
+        "profile", "Prints time, items and bytes of every step.");
+    parser.addOption(profile_option);
+    QCommandLineOption trace_filename_option(
+        "trace", "Writes every step to a file in Chrome trace format.",
+        "trace filename");
+    parser.addOption(trace_filename_option);
+    parser.process(app);
+    if (!parser.isSet(directory_option)) {
+        std::cerr << "Error: directory is not set." << "\n";
+        parser.showHelp(EXIT_FAILURE);
+    }
+    QString format = parser.value(format_option);
+    if (format != "json" && format != "csv") {
+        std::cerr << "Error: unsupported output format." << "\n";
+        parser.showHelp(EXIT_FAILURE);
+    }
+    try {
+        ScanSettings settings;
+        settings.directory = parser.value(directory_option);
+        settings.hash_algorithm_name = parser.value(algorithm_option);
+        settings.max_hashes_distance =
+            get_number(parser.value(threshold_option), "threshold");
+        settings.threads_cnt =
+            get_number(parser.value(threads_option), "threads count");
+        settings.brute_force = parser.isSet(brute_force_option);
+        settings.full_decode = parser.isSet(full_decode_option);
+        settings.validate_decode = parser.isSet(validate_decode_option);
+        if (parser.isSet(memory_budget_option)) {
+            settings.memory_budget =
+                get_number(parser.value(memory_budget_option),
+                           "memory budget") *
+                1024 * 1024;
+        }
+        settings.io_queue_depth =
+            get_number(parser.value(io_depth_option), "I/O queue depth");
+        if (!QDir(settings.directory).exists()) {
+            throw std::runtime_error("Directory '" +
+                                     settings.directory.toStdString() +
+                                     "' does not exist.");
+        }
+        if (parser.isSet(profile_option) ||
+            parser.isSet(trace_filename_option)) {
+            Profiler::enable(parser.isSet(trace_filename_option));
+        }
+        SimilarImagesScanner scanner(settings);
+        PercentPrinter printer;
+        QObject::connect(
+            &scanner, &SimilarImagesScanner::signal_scan_stage_started,
+            [&printer](const QString &text) { printer.set_prefix(text); });
+        QObject::connect(
+            &scanner,
+            &SimilarImagesScanner::signal_scan_stage_iteration_completed,
+            [&printer](double current, double total) {
+                printer.print_if_percent_changed(current, total);
+            });
+        std::vector<SimilarityCluster> similarity_clusters = scanner.scan();
+        std::cerr << "\nFound " << similarity_clusters.size()
+                  << " similarity clusters.\n";
+        if (settings.validate_decode) {
+            print_decode_drift(scanner.get_decode_drift(),
+                               settings.max_hashes_distance);
+        }
+        write_output(format == "json" ? get_json(similarity_clusters)
+                                      : get_csv(similarity_clusters),
+                     parser.value(output_filename_option));
+        if (parser.isSet(profile_option)) {
+            Profiler::print_summary(std::cerr);
+        }
+        if (parser.isSet(trace_filename_option)) {
+            Profiler::write_trace(
+                parser.value(trace_filename_option).toStdString());
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
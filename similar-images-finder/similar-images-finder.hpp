@@ -1,28 +1,23 @@
 #ifndef SIMILAR_IMAGES_FINDER_HPP
 #define SIMILAR_IMAGES_FINDER_HPP
 
-#include <hash-handler/hash-handler.hpp>
+#include "similar-images-scanner.hpp"
+#include "similarities-list-model.hpp"
 
 #include <QDateTime>
 #include <QDebug>
-#include <QDirIterator>
 #include <QFileDialog>
 #include <QImage>
-#include <QListWidget>
+#include <QListView>
 #include <QMessageBox>
 #include <QProgressDialog>
 #include <QScreen>
-
-#include <thread>
+#include <QScrollBar>
 
 namespace Ui {
 class Widget;
 }
 
-struct ImageData;
-
-typedef std::vector<std::unique_ptr<ImageData>> HashesPool, SimilarityCluster;
-
 class SimilarImagesFinder : public QWidget {
     Q_OBJECT
 
@@ -34,28 +29,26 @@ signals:
     void signal_scan_stage_iteration_completed(double, double);
     void signal_scan_stage_started(const QString &);
     void signal_scan_finished();
-    void signal_item_added(QListWidgetItem *);
+    void signal_clusters_added(const QList<QStringList> &);
 
 private slots:
     void slot_browse_clicked();
     void slot_scan_started();
     void slot_remove_clicked();
-    void slot_list_current_item_changed(QListWidgetItem *, QListWidgetItem *);
+    void slot_list_current_changed(const QModelIndex &current,
+                                   const QModelIndex &);
     void slot_location_text_changed();
     void slot_scan_stage_iteration_completed(double current, double total);
     void slot_scan_stage_started(const QString &text);
     void slot_scan_finished();
-    void slot_item_added(QListWidgetItem *item);
+    void slot_clusters_added(const QList<QStringList> &clusters);
 
 private:
-    HashesPool get_hashes_pool();
-    std::vector<SimilarityCluster>
-    get_similarity_clusters(HashesPool &&hashes_pool);
     void build_similarities_list(
         const std::vector<SimilarityCluster> &similarity_clusters);
     void resize_relatively_to_screen_size(double width_multiplier,
                                           double height_multiplier);
-    void remove_adjucent_blank_items();
+    QString get_current_filename() const;
     QImage get_current_item_thumbnail() const;
     QString get_current_item_info() const;
     void init_progress_dialog();
@@ -64,7 +57,8 @@ private:
     void setup_connections();
 
     Ui::Widget *ui;
-    HashHandler hash_handler;
+    SimilaritiesListModel *similarities_model;
+    std::unique_ptr<SimilarImagesScanner> scanner;
     QProgressDialog *progress_dialog;
 };
 
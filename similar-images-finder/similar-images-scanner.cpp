@@ -0,0 +1,529 @@
+#include "similar-images-scanner.hpp"
+
+namespace {
+
+struct DecodedImage {
+    QString filename;
+    // the digest is set only if another file has the same size
+    ContentKey contents;
+    bool is_digested;
+    qint64 mtime;
+    cv::Mat img;
+    // set in the decode validation mode
+    PackedHash full_decode_hash;
+};
+
+} // namespace
+
+// crawled paths waiting for the hashing workers
+static const size_t filenames_queue_capacity = 4096;
+// decoded images kept by a worker until they are hashed together
+static const size_t hashing_chunk_size = 16;
+static const size_t hashing_chunk_bytes = 64 * 1024 * 1024;
+
+static cv::Ptr<cv::img_hash::ImgHashBase>
+get_hash_algorithm(const QString &hash_algorithm_name) {
+    if (hash_algorithm_name == "PHash") {
+        return cv::img_hash::PHash::create();
+    }
+    if (hash_algorithm_name == "AverageHash") {
+        return cv::img_hash::AverageHash::create();
+    }
+    throw std::invalid_argument("Unsupported hash algorithm '" +
+                                hash_algorithm_name.toStdString() + "'.");
+}
+
+// hashes of full resolution decodes are cached apart from the reduced ones
+static QString get_hash_cache_name(const ScanSettings &settings) {
+    return settings.hash_algorithm_name +
+           (settings.full_decode ? "-full-decode" : "");
+}
+
+static QString get_hash_cache_filename(const QString &hash_cache_name) {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+           "/hashes-" + hash_cache_name + ".bin";
+}
+
+// Reads the frame size from the SOF segment, returns an invalid size if the
+// file is not a JPEG.
+static QSize get_jpeg_size(const std::vector<uchar> &data) {
+    QByteArray bytes = QByteArray::fromRawData(
+        reinterpret_cast<const char *>(data.data()), data.size());
+    QBuffer file(&bytes);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QSize();
+    }
+    auto read_byte = [&file](uchar &byte) {
+        return file.getChar(reinterpret_cast<char *>(&byte));
+    };
+    auto read_word = [&read_byte](quint16 &word) {
+        uchar high = 0;
+        uchar low = 0;
+        if (!read_byte(high) || !read_byte(low)) {
+            return false;
+        }
+        word = (high << 8) | low;
+        return true;
+    };
+    uchar byte = 0;
+    if (!read_byte(byte) || byte != 0xFF || !read_byte(byte) || byte != 0xD8) {
+        return QSize();
+    }
+    while (read_byte(byte) && byte == 0xFF) {
+        uchar marker = 0xFF;
+        // markers may be preceded by any number of fill bytes
+        while (marker == 0xFF) {
+            if (!read_byte(marker)) {
+                return QSize();
+            }
+        }
+        // standalone markers have no segment
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            continue;
+        }
+        // start of scan or end of image before any frame header
+        if (marker == 0xDA || marker == 0xD9) {
+            return QSize();
+        }
+        quint16 length = 0;
+        if (!read_word(length) || length < 2) {
+            return QSize();
+        }
+        // SOF0..SOF15 except DHT, JPG and DAC
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+            marker != 0xC8 && marker != 0xCC) {
+            uchar precision = 0;
+            quint16 height = 0;
+            quint16 width = 0;
+            if (!read_byte(precision) || !read_word(height) ||
+                !read_word(width)) {
+                return QSize();
+            }
+            return QSize(width, height);
+        }
+        if (!file.seek(file.pos() + length - 2)) {
+            return QSize();
+        }
+    }
+    return QSize();
+}
+
+// JPEG decoders are able to scale down by 2, 4 or 8 during the inverse DCT,
+// which skips most of the work. The shorter side is kept large enough for
+// the hash, which looks at a 32x32 thumbnail at most.
+static int get_imread_flags(const std::vector<uchar> &data,
+                            bool full_decode) {
+    static const int min_decoded_side = 256;
+    static const std::array<std::pair<int, int>, 3> reduced_imread_flags = {
+        {{8, cv::IMREAD_REDUCED_COLOR_8},
+         {4, cv::IMREAD_REDUCED_COLOR_4},
+         {2, cv::IMREAD_REDUCED_COLOR_2}}};
+    if (full_decode) {
+        return cv::IMREAD_COLOR;
+    }
+    QSize size = get_jpeg_size(data);
+    int min_side = std::min(size.width(), size.height());
+    for (const auto &[scale, flags] : reduced_imread_flags) {
+        if (min_side / scale >= min_decoded_side) {
+            return flags;
+        }
+    }
+    return cv::IMREAD_COLOR;
+}
+
+// decodes the prefetched contents in place
+static cv::Mat decode_image(const QString &filename,
+                            const std::vector<uchar> &data, int flags) {
+    ProfileScope profile_scope("imdecode");
+    profile_scope.add_bytes(data.size());
+    cv::Mat img = cv::imdecode(data, flags);
+    if (img.empty()) {
+        throw std::runtime_error("Empty image " + filename.toStdString());
+    }
+    return img;
+}
+
+static ContentDigest get_digest(const std::vector<uchar> &data) {
+    ProfileScope profile_scope("digest");
+    profile_scope.add_bytes(data.size());
+    QByteArray result = QCryptographicHash::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char *>(data.data()),
+                                data.size()),
+        QCryptographicHash::Sha256);
+    ContentDigest digest;
+    std::copy_n(result.cbegin(), digest.size(), digest.begin());
+    return digest;
+}
+
+// reads the file again, returns false if it is unreadable
+static bool read_digest(const QString &filename, ContentDigest &digest) {
+    ProfileScope profile_scope("digest");
+    QFile file(filename);
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        return false;
+    }
+    profile_scope.add_bytes(file.size());
+    QByteArray result = hash.result();
+    std::copy_n(result.cbegin(), digest.size(), digest.begin());
+    return true;
+}
+
+static QStringList get_image_extensions() {
+    return QStringList() << ".jpg" << ".jpeg" << ".png" << ".tiff" << ".tif";
+}
+
+// Sets of several images become clusters. The pool is filled in no particular
+// order, so the images of a cluster and the clusters by their first image are
+// sorted to keep the result the same from one scan to another.
+static std::vector<SimilarityCluster>
+get_connected_components(DisjointSets &similar_images,
+                         const HashesPool &hashes_pool) {
+    // a set is represented by its smallest element, so the root of an image
+    // is never behind it
+    std::vector<size_t> roots(hashes_pool.size());
+    std::vector<bool> has_others(hashes_pool.size(), false);
+    ProfileScope profile_scope("connected components", hashes_pool.size());
+    for (size_t i = 0; i < hashes_pool.size(); ++i) {
+        roots.at(i) = similar_images.find(i);
+        if (roots.at(i) != i) {
+            has_others.at(roots.at(i)) = true;
+        }
+    }
+    std::vector<size_t> cluster_idxs(hashes_pool.size(), 0);
+    std::vector<SimilarityCluster> similarity_clusters;
+    for (size_t i = 0; i < hashes_pool.size(); ++i) {
+        if (roots.at(i) == i && has_others.at(i)) {
+            cluster_idxs.at(i) = similarity_clusters.size();
+            similarity_clusters.emplace_back();
+        } else if (roots.at(i) == i) {
+            continue;
+        }
+        similarity_clusters.at(cluster_idxs.at(roots.at(i)))
+            .push_back(hashes_pool.get_filename(i));
+    }
+    for (auto &similarity_cluster : similarity_clusters) {
+        similarity_cluster.sort();
+    }
+    std::sort(similarity_clusters.begin(), similarity_clusters.end(),
+              [](const SimilarityCluster &a, const SimilarityCluster &b) {
+                  return a.front() < b.front();
+              });
+    return similarity_clusters;
+}
+
+SimilarImagesScanner::SimilarImagesScanner(const ScanSettings &settings)
+    : settings(settings), hash_handler(get_hash_handler()),
+      hash_cache(get_hash_cache_filename(get_hash_cache_name(settings)),
+                 get_hash_cache_name(settings)) {
+    decode_drift.fill(0);
+    if (settings.threads_cnt == 0) {
+        throw std::invalid_argument("Threads count must be positive.");
+    }
+    if (settings.io_queue_depth == 0) {
+        throw std::invalid_argument("I/O queue depth must be positive.");
+    }
+}
+
+std::vector<SimilarityCluster> SimilarImagesScanner::scan() {
+    return get_similarity_clusters(get_hashes_pool());
+}
+
+void SimilarImagesScanner::forget_removed_files(const QStringList &filenames) {
+    for (const auto &filename : filenames) {
+        hash_cache.remove(filename);
+    }
+    hash_cache.save();
+}
+
+const DecodeDrift &SimilarImagesScanner::get_decode_drift() const {
+    return decode_drift;
+}
+
+HashHandler SimilarImagesScanner::get_hash_handler() const {
+    return HashHandler(get_hash_algorithm(settings.hash_algorithm_name),
+                       [max_hashes_distance = settings.max_hashes_distance](
+                           double hashes_diff) -> bool {
+                           return hashes_diff <= max_hashes_distance;
+                       });
+}
+
+HashesPool SimilarImagesScanner::get_hashes_pool() {
+    emit signal_scan_stage_started("Building hashes pool (stage 1 of 3)...");
+    ProfileScope profile_scope("hashes pool");
+    hash_cache.load();
+    decode_drift.fill(0);
+    QString directory =
+        QDir::cleanPath(QDir(settings.directory).absolutePath());
+    // the tree is crawled while the files found so far are hashed, so the
+    // progress total grows until the crawl is over
+    BoundedQueue<QString> filenames(filenames_queue_capacity);
+    std::atomic<size_t> files_found(0);
+    std::atomic<size_t> files_scanned(0);
+    // the workers push every hash straight into the pool, so that nothing
+    // but its columns is kept per file within the memory budget
+    HashesPool hashes_pool(settings.memory_budget);
+    std::mutex hashes_pool_mutex;
+    // the first error leaving a worker stops the scan and is rethrown once
+    // all the threads are joined
+    std::exception_ptr worker_error;
+    std::mutex worker_error_mutex;
+    std::atomic<bool> is_failed(false);
+    // drift is measured against fresh decodes only
+    FilesPrefetcher prefetcher(filenames, settings.io_queue_depth,
+                               settings.validate_decode ? nullptr
+                                                        : &hash_cache);
+    // started once nothing else may throw before it is joined
+    std::thread crawler([&]() {
+        try {
+            DirectoryCrawler(get_image_extensions())
+                .crawl(directory, settings.threads_cnt,
+                       [&](QString &&filename) {
+                           ++files_found;
+                           // closed if the prefetcher is destroyed before
+                           // the crawl is over
+                           return filenames.push(std::move(filename));
+                       });
+        } catch (const std::exception &e) {
+            qDebug() << e.what();
+        }
+        filenames.close();
+    });
+    // every worker owns its hash algorithm since cv::img_hash instances keep
+    // intermediate buffers and are not safe to share between threads
+    auto hash_files = [&]() {
+        HashHandler worker_hash_handler = get_hash_handler();
+        DecodeDrift worker_decode_drift;
+        worker_decode_drift.fill(0);
+        // decoded images are hashed in chunks through the batch API
+        std::vector<DecodedImage> decoded_imgs;
+        std::vector<cv::Mat> imgs;
+        size_t decoded_bytes = 0;
+        auto hash_decoded_images = [&]() {
+            imgs.clear();
+            for (const auto &decoded_img : decoded_imgs) {
+                imgs.push_back(decoded_img.img);
+            }
+            cv::Mat batch_hashes;
+            worker_hash_handler.compute_batch(imgs.data(), imgs.size(),
+                                              batch_hashes);
+            for (size_t j = 0; j < decoded_imgs.size(); ++j) {
+                const DecodedImage &decoded_img = decoded_imgs.at(j);
+                PackedHash hash = HashHandler::pack(batch_hashes.row(j));
+                hash_cache.insert(decoded_img.filename,
+                                  decoded_img.contents.size, decoded_img.mtime,
+                                  hash);
+                if (settings.validate_decode) {
+                    ++worker_decode_drift.at(HashHandler::get_hamming_distance(
+                        hash, decoded_img.full_decode_hash));
+                }
+                std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                if (decoded_img.is_digested) {
+                    hashes_pool.push_back(hash, decoded_img.filename,
+                                          decoded_img.contents);
+                } else {
+                    hashes_pool.push_back(hash, decoded_img.filename,
+                                          decoded_img.contents.size);
+                }
+            }
+            decoded_imgs.clear();
+            imgs.clear();
+            decoded_bytes = 0;
+        };
+        PrefetchedFile file;
+        while (!is_failed && prefetcher.pop(file)) {
+            emit signal_scan_stage_iteration_completed(++files_scanned,
+                                                       files_found);
+            // unreadable files are reported by the prefetcher
+            if (!file.is_cached && file.data.empty()) {
+                continue;
+            }
+            // cached files are not decoded anyway, copies among them get
+            // united by their identical hashes
+            if (file.is_cached) {
+                std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                hashes_pool.push_back(file.cached_hash, file.filename);
+                continue;
+            }
+            DecodedImage decoded_img{file.filename, ContentKey{file.size, {}},
+                                     false, file.mtime, cv::Mat(), 0};
+            // files are digested only once another file has the same size,
+            // the first file of that size is read again for it
+            uint32_t first_id = 0;
+            bool is_first_digested = false;
+            {
+                std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                decoded_img.is_digested = hashes_pool.find_size(
+                    file.size, first_id, is_first_digested);
+            }
+            if (decoded_img.is_digested) {
+                decoded_img.contents.digest = get_digest(file.data);
+                if (!is_first_digested) {
+                    QString first_filename;
+                    {
+                        std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                        first_filename = hashes_pool.get_filename(first_id);
+                    }
+                    ContentKey first_contents{file.size, {}};
+                    if (read_digest(first_filename, first_contents.digest)) {
+                        std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                        hashes_pool.set_digest(first_id, first_contents);
+                    }
+                }
+                // only the first file found with given contents is decoded,
+                // a copy found while it is being decoded is decoded as well
+                // and gets united with it by the identical hash
+                PackedHash hash = 0;
+                bool is_copy = false;
+                {
+                    std::lock_guard<std::mutex> lock(hashes_pool_mutex);
+                    is_copy = hashes_pool.push_back_copy(
+                        file.filename, decoded_img.contents, hash);
+                }
+                if (is_copy) {
+                    hash_cache.insert(file.filename, file.size, file.mtime,
+                                      hash);
+                    prefetcher.recycle(std::move(file.data));
+                    continue;
+                }
+            }
+            try {
+                decoded_img.img = decode_image(
+                    file.filename, file.data,
+                    get_imread_flags(file.data, settings.full_decode));
+                // both decodes are made while the contents are at hand
+                if (settings.validate_decode) {
+                    decoded_img.full_decode_hash =
+                        HashHandler::pack(worker_hash_handler.compute(
+                            decode_image(file.filename, file.data,
+                                         cv::IMREAD_COLOR)));
+                }
+            } catch (const std::exception &e) {
+                // cv::Exception for images the codec fails on
+                qDebug() << e.what();
+            }
+            prefetcher.recycle(std::move(file.data));
+            if (decoded_img.img.empty()) {
+                continue;
+            }
+            decoded_bytes +=
+                decoded_img.img.total() * decoded_img.img.elemSize();
+            decoded_imgs.push_back(std::move(decoded_img));
+            if (decoded_imgs.size() == hashing_chunk_size ||
+                decoded_bytes >= hashing_chunk_bytes) {
+                hash_decoded_images();
+            }
+        }
+        hash_decoded_images();
+        std::lock_guard<std::mutex> lock(decode_drift_mutex);
+        for (size_t i = 0; i < decode_drift.size(); ++i) {
+            decode_drift.at(i) += worker_decode_drift.at(i);
+        }
+    };
+    auto try_hash_files = [&]() {
+        try {
+            hash_files();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(worker_error_mutex);
+            if (worker_error == nullptr) {
+                worker_error = std::current_exception();
+            }
+            // the crawler stops as soon as it finds the next file
+            is_failed = true;
+            filenames.close();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < settings.threads_cnt; ++i) {
+        workers.emplace_back(try_hash_files);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    // the readers may have stopped before draining the queue, the crawler
+    // would then wait on a full one forever
+    filenames.close();
+    crawler.join();
+    if (worker_error != nullptr) {
+        std::rethrow_exception(worker_error);
+    }
+    profile_scope.set_items(files_found);
+    hashes_pool.release_contents();
+    hashes_pool.sort_by_filename();
+    hash_cache.remove_unlisted(directory);
+    hash_cache.save();
+    return hashes_pool;
+}
+
+std::vector<SimilarityCluster>
+SimilarImagesScanner::get_similarity_clusters(HashesPool &&hashes_pool) {
+    if (settings.brute_force) {
+        return get_similarity_clusters_brute_force(std::move(hashes_pool));
+    }
+    emit signal_scan_stage_started(
+        "Building similarity clusters (stage 2 of 3)...");
+    ProfileScope profile_scope("similarity clusters", hashes_pool.size());
+    const std::vector<PackedHash> &packed_hashes = hashes_pool.get_hashes();
+    std::unique_ptr<HammingIndex> index;
+    {
+        ProfileScope index_profile_scope("index build", packed_hashes.size());
+        index = std::make_unique<HammingIndex>(
+            packed_hashes, hash_handler.get_max_matching_distance());
+    }
+    DisjointSets similar_images(hashes_pool.size());
+    size_t hashes_cnt = hashes_pool.size();
+    size_t threads_cnt = std::min(settings.threads_cnt, hashes_cnt);
+    // the index is read-only and the union-find is lock-free, so neighbour
+    // queries run concurrently and the resulting sets do not depend on the
+    // order in which the pairs are united
+    std::atomic<size_t> next_hash_idx(0);
+    std::atomic<size_t> hashes_processed(0);
+    auto unite_neighbours = [&]() {
+        for (size_t i = next_hash_idx++; i < hashes_cnt; i = next_hash_idx++) {
+            emit signal_scan_stage_iteration_completed(++hashes_processed,
+                                                       hashes_cnt);
+            // copies share the neighbours of the image they are copies of
+            if (hashes_pool.get_original_id(i) != i) {
+                similar_images.unite(hashes_pool.get_original_id(i), i);
+                continue;
+            }
+            ProfileScope neighbours_profile_scope("find neighbours");
+            for (size_t j : index->find_neighbours(packed_hashes.at(i))) {
+                if (j > i && hashes_pool.get_original_id(j) == j) {
+                    similar_images.unite(i, j);
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads_cnt; ++i) {
+        workers.emplace_back(unite_neighbours);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    return get_connected_components(similar_images, hashes_pool);
+}
+
+std::vector<SimilarityCluster>
+SimilarImagesScanner::get_similarity_clusters_brute_force(
+    HashesPool &&hashes_pool) {
+    emit signal_scan_stage_started(
+        "Building similarity clusters (stage 2 of 3)...");
+    ProfileScope profile_scope("similarity clusters", hashes_pool.size());
+    const std::vector<PackedHash> &packed_hashes = hashes_pool.get_hashes();
+    DisjointSets similar_images(hashes_pool.size());
+    for (size_t i = 0; i < hashes_pool.size(); ++i) {
+        emit signal_scan_stage_iteration_completed(i + 1, hashes_pool.size());
+        if (hashes_pool.get_original_id(i) != i) {
+            similar_images.unite(hashes_pool.get_original_id(i), i);
+            continue;
+        }
+        for (size_t j : hash_handler.compare_batch(
+                 packed_hashes.at(i), packed_hashes.data() + i + 1,
+                 packed_hashes.size() - i - 1)) {
+            similar_images.unite(i, i + 1 + j);
+        }
+    }
+    return get_connected_components(similar_images, hashes_pool);
+}
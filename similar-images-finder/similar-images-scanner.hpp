@@ -0,0 +1,87 @@
+#ifndef SIMILAR_IMAGES_SCANNER_HPP
+#define SIMILAR_IMAGES_SCANNER_HPP
+
+#include <hash-handler/bounded-queue.hpp>
+#include <hash-handler/disjoint-sets.hpp>
+#include <hash-handler/hamming-index.hpp>
+#include <hash-handler/hash-handler.hpp>
+
+#include "directory-crawler.hpp"
+#include "files-prefetcher.hpp"
+#include "hash-cache.hpp"
+#include "hashes-pool.hpp"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QObject>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+typedef QStringList SimilarityCluster;
+
+struct ScanSettings {
+    QString directory;
+    // PHash or AverageHash
+    QString hash_algorithm_name = "PHash";
+    size_t max_hashes_distance = 5;
+    size_t threads_cnt = 1;
+    // compare every pair of images instead of looking up the Hamming index
+    bool brute_force = false;
+    // decode JPEGs at full resolution instead of a reduced DCT scale
+    bool full_decode = false;
+    // decode every image at both resolutions and measure the hash drift,
+    // ignoring the cached hashes
+    bool validate_decode = false;
+    // memory of the pool past which its paths spill to a temporary file,
+    // the other columns and the hash cache stay in memory regardless
+    size_t memory_budget = std::numeric_limits<size_t>::max();
+    // files read ahead of decoding at once, deeper queues keep spinning
+    // disks and network shares busy
+    size_t io_queue_depth = 8;
+};
+
+// counts of images by Hamming distance between the hashes of their reduced
+// and full resolution decodes
+typedef std::array<size_t, sizeof(PackedHash) * 8 + 1> DecodeDrift;
+
+// Scanning core shared by the GUI and the command line tool. Signals are
+// emitted from the scanning threads.
+class SimilarImagesScanner : public QObject {
+    Q_OBJECT
+
+public:
+    explicit SimilarImagesScanner(const ScanSettings &settings);
+    std::vector<SimilarityCluster> scan();
+    // stage 2 of a scan over an already built pool
+    std::vector<SimilarityCluster>
+    get_similarity_clusters(HashesPool &&hashes_pool);
+    void forget_removed_files(const QStringList &filenames);
+    // filled by a scan in the decode validation mode
+    const DecodeDrift &get_decode_drift() const;
+
+signals:
+    void signal_scan_stage_iteration_completed(double, double);
+    void signal_scan_stage_started(const QString &);
+
+private:
+    HashesPool get_hashes_pool();
+    std::vector<SimilarityCluster>
+    get_similarity_clusters_brute_force(HashesPool &&hashes_pool);
+    HashHandler get_hash_handler() const;
+
+    const ScanSettings settings;
+    HashHandler hash_handler;
+    HashCache hash_cache;
+    DecodeDrift decode_drift;
+    std::mutex decode_drift_mutex;
+};
+
+#endif // SIMILAR_IMAGES_SCANNER_HPP
@@ -0,0 +1,179 @@
+#include "similarities-list-model.hpp"
+
+static const QSize icon_size(32, 32);
+// icons kept decoded, the cost of an icon is one unit
+static const int icons_cache_capacity = 4096;
+
+static QImage get_image_icon(const QString &image_name) {
+    QImageReader reader(image_name);
+    // lets the decoder skip most of the pixels where the format supports it
+    QSize size = reader.size();
+    if (size.isValid()) {
+        reader.setScaledSize(size.scaled(icon_size, Qt::KeepAspectRatio));
+    }
+    return reader.read().scaled(icon_size, Qt::KeepAspectRatio,
+                                Qt::SmoothTransformation);
+}
+
+// shown until the icon is decoded so that the row height does not change
+static const QPixmap &get_placeholder_icon() {
+    static const QPixmap placeholder_icon = []() {
+        QPixmap pixmap(icon_size);
+        pixmap.fill(Qt::transparent);
+        return pixmap;
+    }();
+    return placeholder_icon;
+}
+
+SimilaritiesListModel::SimilaritiesListModel(QObject *parent)
+    : QAbstractListModel(parent), icons(icons_cache_capacity) {}
+
+SimilaritiesListModel::~SimilaritiesListModel() {
+    // no icon is delivered once the model is gone
+    icons_pool.clear();
+    icons_pool.waitForDone();
+}
+
+int SimilaritiesListModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : rows.size();
+}
+
+QVariant SimilaritiesListModel::data(const QModelIndex &index,
+                                     int role) const {
+    if (!index.isValid() || index.row() >= rowCount()) {
+        return QVariant();
+    }
+    const Row &row = rows.at(index.row());
+    if (row.filename.isEmpty()) {
+        return QVariant();
+    }
+    switch (role) {
+    case Qt::DisplayRole:
+        return row.filename;
+    case Qt::CheckStateRole:
+        return static_cast<int>(row.check_state);
+    case Qt::DecorationRole:
+        if (const QPixmap *icon = icons.object(row.filename)) {
+            return *icon;
+        }
+        request_icon(index.row());
+        return get_placeholder_icon();
+    default:
+        return QVariant();
+    }
+}
+
+bool SimilaritiesListModel::setData(const QModelIndex &index,
+                                    const QVariant &value, int role) {
+    if (!index.isValid() || role != Qt::CheckStateRole ||
+        (flags(index) & Qt::ItemIsUserCheckable) == 0) {
+        return false;
+    }
+    rows.at(index.row()).check_state =
+        static_cast<Qt::CheckState>(value.toInt());
+    emit dataChanged(index, index, {Qt::CheckStateRole});
+    return true;
+}
+
+Qt::ItemFlags SimilaritiesListModel::flags(const QModelIndex &index) const {
+    if (!index.isValid() || index.row() >= rowCount() ||
+        rows.at(index.row()).filename.isEmpty()) {
+        return Qt::NoItemFlags;
+    }
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsUserCheckable;
+}
+
+void SimilaritiesListModel::append_clusters(
+    const QList<QStringList> &clusters) {
+    std::vector<Row> new_rows;
+    for (const auto &cluster : clusters) {
+        if (!rows.empty() || !new_rows.empty()) {
+            new_rows.push_back(Row{QString(), Qt::Unchecked});
+        }
+        for (const auto &filename : cluster) {
+            new_rows.push_back(Row{filename, Qt::Unchecked});
+        }
+    }
+    if (new_rows.empty()) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), rows.size(),
+                    rows.size() + new_rows.size() - 1);
+    rows.insert(rows.end(), new_rows.begin(), new_rows.end());
+    endInsertRows();
+}
+
+QStringList SimilaritiesListModel::get_checked_filenames() const {
+    QStringList filenames;
+    for (const auto &row : rows) {
+        if (!row.filename.isEmpty() && row.check_state != Qt::Unchecked) {
+            filenames.push_back(row.filename);
+        }
+    }
+    return filenames;
+}
+
+void SimilaritiesListModel::remove_checked_rows() {
+    std::vector<Row> remaining_rows;
+    for (const auto &row : rows) {
+        bool is_blank = row.filename.isEmpty();
+        if (!is_blank && row.check_state != Qt::Unchecked) {
+            continue;
+        }
+        if (is_blank && (remaining_rows.empty() ||
+                         remaining_rows.back().filename.isEmpty())) {
+            continue;
+        }
+        remaining_rows.push_back(row);
+    }
+    if (!remaining_rows.empty() && remaining_rows.back().filename.isEmpty()) {
+        remaining_rows.pop_back();
+    }
+    beginResetModel();
+    rows = std::move(remaining_rows);
+    endResetModel();
+}
+
+void SimilaritiesListModel::clear() {
+    cancel_pending_icons();
+    beginResetModel();
+    rows.clear();
+    icons.clear();
+    endResetModel();
+}
+
+void SimilaritiesListModel::cancel_pending_icons() {
+    icons_pool.clear();
+    pending_icons.clear();
+}
+
+void SimilaritiesListModel::request_icon(int row) const {
+    QString filename = rows.at(row).filename;
+    if (pending_icons.contains(filename)) {
+        return;
+    }
+    pending_icons.insert(filename);
+    // the pool is waited for before destruction, so the model outlives
+    // every task
+    auto model = const_cast<SimilaritiesListModel *>(this);
+    icons_pool.start([model, row, filename]() {
+        QImage icon = get_image_icon(filename);
+        QMetaObject::invokeMethod(
+            model,
+            [model, row, filename, icon]() {
+                model->on_icon_loaded(row, filename, icon);
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void SimilaritiesListModel::on_icon_loaded(int row, const QString &filename,
+                                           const QImage &icon) {
+    pending_icons.remove(filename);
+    // an unreadable image gets an empty icon and is not decoded again
+    icons.insert(filename, new QPixmap(QPixmap::fromImage(icon)));
+    // rows may have been removed meanwhile
+    if (row < rowCount() && rows.at(row).filename == filename) {
+        emit dataChanged(index(row), index(row), {Qt::DecorationRole});
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SIMILARITIES_LIST_MODEL_HPP
+#define SIMILARITIES_LIST_MODEL_HPP
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QImageReader>
+#include <QPixmap>
+#include <QSet>
+#include <QThreadPool>
+
+#include <vector>
+
+// Similarity clusters as a flat list where blank rows separate the clusters.
+// Icons are decoded on a thread pool once a view asks for them, which
+// happens only for the rows being painted.
+class SimilaritiesListModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    explicit SimilaritiesListModel(QObject *parent = nullptr);
+    ~SimilaritiesListModel();
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    bool setData(const QModelIndex &index, const QVariant &value,
+                 int role) override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+    void append_clusters(const QList<QStringList> &clusters);
+    QStringList get_checked_filenames() const;
+    // blank rows left without a cluster in between are dropped as well
+    void remove_checked_rows();
+    void clear();
+    // forgets the icons requested but not being decoded yet, e.g. for the
+    // rows scrolled out of sight
+    void cancel_pending_icons();
+
+private:
+    struct Row {
+        // empty for a blank row
+        QString filename;
+        Qt::CheckState check_state;
+    };
+
+    void request_icon(int row) const;
+    void on_icon_loaded(int row, const QString &filename, const QImage &icon);
+
+    std::vector<Row> rows;
+    mutable QCache<QString, QPixmap> icons;
+    mutable QSet<QString> pending_icons;
+    mutable QThreadPool icons_pool;
+};
+
+#endif // SIMILARITIES_LIST_MODEL_HPP
@@ -0,0 +1,379 @@
+#include <hash-handler/bounded-queue.hpp>
+#include <hash-handler/disjoint-sets.hpp>
+#include <hash-handler/hamming-index.hpp>
+#include <key-frames-extractor/video-fingerprint.hpp>
+#include <similar-images-finder/hash-cache.hpp>
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <bitset>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+// every input is generated from fixed seeds, so a failure is reproducible
+static const unsigned hashes_seed = 1;
+static const unsigned images_seed = 2;
+static const size_t threads_cnt = 8;
+
+static void check(bool condition, const std::string &message) {
+    if (!condition) {
+        throw std::runtime_error(message);
+    }
+}
+
+// hashes scattered around a few centers, so that the index has neighbours
+// to find at every distance
+static std::vector<PackedHash> get_clustered_hashes(std::mt19937_64 &rng,
+                                                    size_t hashes_cnt) {
+    std::vector<PackedHash> centers(16);
+    for (auto &center : centers) {
+        center = rng();
+    }
+    std::vector<PackedHash> hashes;
+    for (size_t i = 0; i < hashes_cnt; ++i) {
+        PackedHash hash = centers.at(rng() % centers.size());
+        for (size_t j = rng() % 12; j > 0; --j) {
+            hash ^= PackedHash(1) << (rng() % 64);
+        }
+        hashes.push_back(hash);
+    }
+    return hashes;
+}
+
+static size_t get_reference_distance(PackedHash hash_a, PackedHash hash_b) {
+    return std::bitset<64>(hash_a ^ hash_b).count();
+}
+
+static void test_hamming_index() {
+    std::mt19937_64 rng(hashes_seed);
+    std::vector<PackedHash> hashes = get_clustered_hashes(rng, 2000);
+    std::vector<PackedHash> queries(hashes.begin(), hashes.begin() + 100);
+    for (size_t i = 0; i < 100; ++i) {
+        queries.push_back(rng());
+    }
+    for (size_t max_distance : {0, 1, 3, 5, 10}) {
+        HammingIndex index(hashes, max_distance);
+        for (PackedHash query : queries) {
+            std::vector<size_t> expected;
+            for (size_t i = 0; i < hashes.size(); ++i) {
+                if (get_reference_distance(query, hashes.at(i)) <=
+                    max_distance) {
+                    expected.push_back(i);
+                }
+            }
+            check(index.find_neighbours(query) == expected,
+                  "HammingIndex differs from brute force at distance " +
+                      std::to_string(max_distance) + ".");
+        }
+    }
+}
+
+// the vectorized loops are compiled in with IMG_HASH_TOOLS_NATIVE_ARCH,
+// every count leaves a different tail to the scalar loop
+static void test_hamming_distances() {
+    std::mt19937_64 rng(hashes_seed);
+    std::vector<PackedHash> hashes = {0, ~PackedHash(0), 1,
+                                      PackedHash(1) << 63};
+    while (hashes.size() < 67) {
+        hashes.push_back(rng());
+    }
+    std::vector<PackedHash> queries = {0, ~PackedHash(0), rng()};
+    for (PackedHash query : queries) {
+        for (size_t hashes_cnt = 0; hashes_cnt <= hashes.size();
+             ++hashes_cnt) {
+            // the last distance guards against writing past the end
+            std::vector<uint8_t> distances(hashes_cnt + 1, 0xff);
+            HashHandler::get_hamming_distances(query, hashes.data(),
+                                               hashes_cnt, distances.data());
+            for (size_t i = 0; i < hashes_cnt; ++i) {
+                check(distances.at(i) ==
+                              get_reference_distance(query, hashes.at(i)) &&
+                          distances.at(i) == HashHandler::get_hamming_distance(
+                                                 query, hashes.at(i)),
+                      "Wrong Hamming distance of hash " + std::to_string(i) +
+                          " of " + std::to_string(hashes_cnt) + ".");
+            }
+            check(distances.back() == 0xff,
+                  "Hamming distances written past " +
+                      std::to_string(hashes_cnt) + " hashes.");
+        }
+    }
+}
+
+// a hash must not depend on the batch it is computed in
+static void test_batch_hashes() {
+    cv::RNG rng(images_seed);
+    std::vector<cv::Mat> imgs;
+    for (size_t i = 0; i < 11; ++i) {
+        cv::Mat img(48 + i, 64, CV_8UC3);
+        rng.fill(img, cv::RNG::UNIFORM, 0, 256);
+        imgs.push_back(img);
+    }
+    std::vector<cv::Ptr<cv::img_hash::ImgHashBase>> hash_algorithms = {
+        cv::img_hash::AverageHash::create(), cv::img_hash::PHash::create()};
+    for (const auto &hash_algorithm : hash_algorithms) {
+        HashHandler hash_handler(hash_algorithm,
+                                 [](double distance) { return distance <= 5; });
+        cv::Mat batch_hashes;
+        hash_handler.compute_batch(imgs.data(), imgs.size(), batch_hashes);
+        for (size_t i = 0; i < imgs.size(); ++i) {
+            cv::Mat hash = hash_handler.compute(imgs.at(i));
+            check(HashHandler::pack(batch_hashes.row(i)) ==
+                      HashHandler::pack(hash),
+                  "Hash of image " + std::to_string(i) +
+                      " differs in the batch.");
+        }
+    }
+}
+
+static void test_bounded_queue() {
+    BoundedQueue<int> queue(2);
+    std::thread producer([&]() {
+        for (int i = 0; i < 100; ++i) {
+            queue.push(i);
+        }
+        queue.close();
+    });
+    int item = 0;
+    for (int i = 0; i < 100; ++i) {
+        check(queue.pop(item) && item == i, "Queue lost the order.");
+    }
+    check(!queue.pop(item), "Closed and drained queue popped an item.");
+    producer.join();
+
+    BoundedQueue<int> closed_queue(2);
+    closed_queue.push(1);
+    closed_queue.close();
+    check(!closed_queue.push(2), "Closed queue accepted an item.");
+    check(closed_queue.pop(item) && item == 1,
+          "Closed queue was not drained.");
+    check(!closed_queue.pop(item), "Closed and drained queue popped an item.");
+
+    // closing wakes up both a consumer of an empty queue and a producer of
+    // a full one
+    BoundedQueue<int> empty_queue(1);
+    bool is_popped = true;
+    std::thread consumer([&]() { is_popped = empty_queue.pop(item); });
+    BoundedQueue<int> full_queue(1);
+    full_queue.push(1);
+    bool is_pushed = true;
+    std::thread blocked_producer([&]() { is_pushed = full_queue.push(2); });
+    empty_queue.close();
+    full_queue.close();
+    consumer.join();
+    blocked_producer.join();
+    check(!is_popped && !is_pushed, "Closing did not wake up the queue.");
+}
+
+static void test_disjoint_sets() {
+    // the elements of a residue class end up in one set, united in a
+    // different order by every thread
+    const size_t elements_cnt = 100000;
+    const size_t classes_cnt = 10;
+    DisjointSets disjoint_sets(elements_cnt);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threads_cnt; ++i) {
+        threads.emplace_back([&, i]() {
+            std::vector<size_t> elements;
+            for (size_t j = i; j + classes_cnt < elements_cnt;
+                 j += threads_cnt) {
+                elements.push_back(j);
+            }
+            std::shuffle(elements.begin(), elements.end(),
+                         std::mt19937_64(hashes_seed + i));
+            for (size_t element : elements) {
+                disjoint_sets.unite(element + classes_cnt, element);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    check(disjoint_sets.size() == elements_cnt, "Wrong count of elements.");
+    for (size_t i = 0; i < elements_cnt; ++i) {
+        check(disjoint_sets.find(i) == i % classes_cnt,
+              "Element " + std::to_string(i) +
+                  " is not represented by the smallest one of its set.");
+    }
+}
+
+static void test_hash_cache() {
+    QTemporaryDir directory;
+    check(directory.isValid(), "Unable to create a temporary directory.");
+    QString cache_filename = directory.filePath("cache.bin");
+    HashCache cache(cache_filename, "PHash");
+    cache.insert("/images/a.jpg", 10, 100, 0x0123456789abcdef);
+    cache.insert("/images/b.jpg", 20, 200, ~PackedHash(0));
+    cache.save();
+
+    HashCache loaded_cache(cache_filename, "PHash");
+    loaded_cache.load();
+    PackedHash hash = 0;
+    check(loaded_cache.find("/images/a.jpg", 10, 100, hash) &&
+              hash == 0x0123456789abcdef,
+          "Hash cache lost an entry.");
+    check(loaded_cache.find("/images/b.jpg", 20, 200, hash) &&
+              hash == ~PackedHash(0),
+          "Hash cache lost an entry.");
+    check(!loaded_cache.find("/images/a.jpg", 10, 101, hash),
+          "Hash cache found a modified file.");
+
+    HashCache other_cache(cache_filename, "AverageHash");
+    other_cache.load();
+    check(!other_cache.find("/images/a.jpg", 10, 100, hash),
+          "Hash cache of another algorithm was loaded.");
+
+    check(QFile::resize(cache_filename, QFile(cache_filename).size() - 4),
+          "Unable to truncate the hash cache.");
+    loaded_cache.load();
+    check(!loaded_cache.find("/images/a.jpg", 10, 100, hash) &&
+              !loaded_cache.find("/images/b.jpg", 20, 200, hash),
+          "Corrupted hash cache was loaded.");
+}
+
+static void test_video_fingerprint() {
+    QTemporaryDir directory;
+    check(directory.isValid(), "Unable to create a temporary directory.");
+    // only the size and the modification time of the video are checked
+    QString video_filename = directory.filePath("video.mp4");
+    QFile video_file(video_filename);
+    check(video_file.open(QIODevice::WriteOnly) &&
+              video_file.write("video") == 5,
+          "Unable to write the video.");
+    video_file.close();
+    // shaped like AverageHash, PHash, ColorMomentHash and RadialVarianceHash
+    const std::array<std::pair<int, int>, VideoFingerprint::hashes_cnt>
+        hash_shapes = {std::make_pair(8, CV_8U), std::make_pair(8, CV_8U),
+                       std::make_pair(42, CV_64F), std::make_pair(40, CV_8U)};
+    cv::RNG rng(images_seed);
+    VideoFingerprint fingerprint;
+    std::vector<std::array<cv::Mat, VideoFingerprint::hashes_cnt>> frames;
+    for (size_t i = 0; i < 10; ++i) {
+        std::array<cv::Mat, VideoFingerprint::hashes_cnt> hashes;
+        for (size_t j = 0; j < hashes.size(); ++j) {
+            hashes.at(j).create(1, hash_shapes.at(j).first,
+                                hash_shapes.at(j).second);
+            rng.fill(hashes.at(j), cv::RNG::UNIFORM, 0, 256);
+        }
+        fingerprint.append(i * 40., hashes);
+        frames.push_back(hashes);
+    }
+    fingerprint.save(video_filename);
+
+    VideoFingerprint loaded_fingerprint;
+    check(loaded_fingerprint.load(video_filename) &&
+              loaded_fingerprint.get_frames_cnt() == frames.size(),
+          "Fingerprint was not loaded.");
+    for (size_t i = 0; i < frames.size(); ++i) {
+        check(loaded_fingerprint.get_msec(i) == i * 40.,
+              "Fingerprint lost the timestamp of frame " + std::to_string(i) +
+                  ".");
+        for (size_t j = 0; j < VideoFingerprint::hashes_cnt; ++j) {
+            check(cv::norm(loaded_fingerprint.get_hash(j, i),
+                           frames.at(i).at(j), cv::NORM_INF) == 0,
+                  "Fingerprint lost hash " + std::to_string(j) +
+                      " of frame " + std::to_string(i) + ".");
+        }
+    }
+
+    // the frames count follows the magic, version, size and mtime
+    QFile fingerprint_file(VideoFingerprint::get_filename(video_filename));
+    check(fingerprint_file.open(QIODevice::ReadWrite) &&
+              fingerprint_file.seek(24),
+          "Unable to open the fingerprint.");
+    QDataStream out(&fingerprint_file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << (quint64(1) << 60);
+    fingerprint_file.close();
+    check(!loaded_fingerprint.load(video_filename),
+          "Fingerprint with a corrupted frames count was loaded.");
+
+    fingerprint.save(video_filename);
+    check(video_file.open(QIODevice::Append) && video_file.write("!") == 1,
+          "Unable to write the video.");
+    video_file.close();
+    check(!loaded_fingerprint.load(video_filename),
+          "Fingerprint of a modified video was loaded.");
+}
+
+static void test_hashes_pool() {
+    // the budget is exceeded by the first images already
+    HashesPool spilled_pool(1024);
+    std::map<QString, PackedHash> expected_hashes;
+    for (size_t i = 0; i < 1000; ++i) {
+        QString filename =
+            QString("/images/%1/image-%2.jpg").arg(i % 7).arg(999 - i);
+        spilled_pool.push_back(i, filename);
+        expected_hashes.emplace(filename, i);
+    }
+    check(spilled_pool.is_spilled(), "Hashes pool was not spilled.");
+    for (size_t i = 0; i < spilled_pool.size(); ++i) {
+        check(spilled_pool.get_hashes().at(i) ==
+                  expected_hashes.at(spilled_pool.get_filename(i)),
+              "Spilled hashes pool lost path " + std::to_string(i) + ".");
+    }
+    spilled_pool.sort_by_filename();
+    auto expected_it = expected_hashes.begin();
+    for (size_t i = 0; i < spilled_pool.size(); ++i, ++expected_it) {
+        check(spilled_pool.get_filename(i) == expected_it->first &&
+                  spilled_pool.get_hashes().at(i) == expected_it->second,
+              "Sorted hashes pool lost path " + std::to_string(i) + ".");
+    }
+
+    // the first copy in the sorted order becomes the original
+    HashesPool pool;
+    ContentKey contents{10, ContentDigest()};
+    contents.digest.fill(1);
+    uint32_t id = pool.push_back(5, "/images/c.jpg", contents.size);
+    bool is_digested = true;
+    check(pool.find_size(contents.size, id, is_digested) && !is_digested,
+          "Hashes pool lost a size.");
+    pool.set_digest(id, contents);
+    PackedHash hash = 0;
+    check(pool.push_back_copy("/images/a.jpg", contents, hash) && hash == 5,
+          "Hashes pool missed a copy.");
+    check(!pool.push_back_copy("/images/b.jpg", ContentKey{11, contents.digest},
+                               hash),
+          "Hashes pool found a copy of other contents.");
+    pool.push_back(6, "/images/b.jpg", 11);
+    pool.release_contents();
+    pool.sort_by_filename();
+    check(pool.get_filename(0) == "/images/a.jpg" &&
+              pool.get_original_id(0) == 0 && pool.get_original_id(1) == 1 &&
+              pool.get_original_id(2) == 0 && pool.get_hashes().at(0) == 5,
+          "Sorted hashes pool lost the original of a copy.");
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    const std::map<std::string, std::function<void()>> tests = {
+        {"hamming_index", test_hamming_index},
+        {"hamming_distances", test_hamming_distances},
+        {"batch_hashes", test_batch_hashes},
+        {"bounded_queue", test_bounded_queue},
+        {"disjoint_sets", test_disjoint_sets},
+        {"hash_cache", test_hash_cache},
+        {"video_fingerprint", test_video_fingerprint},
+        {"hashes_pool", test_hashes_pool}};
+    // every test is run unless one is given
+    try {
+        for (const auto &test : tests) {
+            if (argc < 2 || test.first == argv[1]) {
+                test.second();
+                std::cout << test.first << ": passed\n";
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}